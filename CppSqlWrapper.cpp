@@ -31,8 +31,22 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <algorithm>
 #include <exception>
 #include <sstream>
+#include <ostream>
+#include <vector>
+#include <errno.h>
+#include <time.h>
+#ifdef _WIN32
+#include <io.h>
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "sqlite3.h"
 
@@ -61,41 +75,93 @@ void ThrowStatusCodeException(int statusCode, sqlite3* db) {
 }
 inline void ThrowStatusCodeException(int statusCode, sqlite3_stmt* vm) { ThrowStatusCodeException(statusCode, sqlite3_db_handle(vm)); }
 
+enum { ABORT_TIMEOUT = 1, ABORT_CANCELLED = 2 };
+void ThrowAbortException(int reason, bool rolledBack = false) {
+	if (reason == ABORT_TIMEOUT)
+		throw SqlDatabaseTimeoutException(rolledBack);
+	throw SqlDatabaseCancelledException(rolledBack);
+}
+
+// Milliseconds on a clock that never goes backwards
+static int64_t MonotonicMs() {
+#ifdef _WIN32
+	return (int64_t)GetTickCount64();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 #ifdef _MSC_VER // Disable "warning C4355: 'this' : used in base member initializer list".
 #pragma warning(push)
 #pragma warning(disable:4355)
 #endif
 SqlStatement::SqlStatement()
-	: mpVM(0), mBindNext(1), mResult(this), mEndOfRows(true), mColsInResult(0)
+	: mpVM(0), mpDatabase(0), mBindNext(1), mResult(this), mEndOfRows(true), mColsInResult(0),
+	  mNumColumns(0), mpColumns(0),
+	  mFullScanBase(0), mAutoIndexBase(0), mPlanReprepares(-1),
+	  mnTimeoutMs(0), mDeadlineMs(0), mpCancellationToken(0), mNeedsReset(false),
+	  mpParamNames(0)
 {}
-SqlStatement::SqlStatement(sqlite3_stmt* pVM)
-	: mpVM(pVM), mBindNext(1), mResult(this), mEndOfRows(true), mColsInResult(0)
+SqlStatement::SqlStatement(sqlite3_stmt* pVM, SqlDatabase* pDatabase)
+	: mpVM(pVM), mpDatabase(pDatabase), mBindNext(1), mResult(this), mEndOfRows(true), mColsInResult(0),
+	  mNumColumns(pVM ? sqlite3_column_count(pVM) : 0), mpColumns(0),
+	  mFullScanBase(0), mAutoIndexBase(0), mPlanReprepares(-1),
+	  mnTimeoutMs(0), mDeadlineMs(0), mpCancellationToken(0), mNeedsReset(false),
+	  mpParamNames(0)
 {}
 
 SqlStatement::SqlStatement(const SqlStatement& rStatement)
 	:
     mpVM(rStatement.mpVM),
+	mpDatabase(rStatement.mpDatabase),
 	mBindNext(rStatement.mBindNext),
 	mEndOfRows(rStatement.mEndOfRows),
 	mResult(this),
-	mColsInResult(rStatement.mColsInResult)
+	mColsInResult(rStatement.mColsInResult),
+	mNumColumns(rStatement.mNumColumns),
+	mpColumns(rStatement.mpColumns),
+	mFullScanBase(rStatement.mFullScanBase),
+	mAutoIndexBase(rStatement.mAutoIndexBase),
+	mPlanReprepares(rStatement.mPlanReprepares),
+	mnTimeoutMs(rStatement.mnTimeoutMs),
+	mDeadlineMs(rStatement.mDeadlineMs),
+	mpCancellationToken(rStatement.mpCancellationToken),
+	mNeedsReset(rStatement.mNeedsReset),
+	mpParamNames(rStatement.mpParamNames)
 {
 	// Important: the new object will now own the VM, so we must ensure
 	// rStatement doesn't finalize() the VM when it gets destroyed:
 	const_cast<SqlStatement&>(rStatement).mpVM = 0;
+	rStatement.mpColumns = 0;
+	rStatement.mpParamNames = 0;
 }
 
 SqlStatement& SqlStatement::operator=(const SqlStatement& rStatement) {
 	destroy();
     mpVM = rStatement.mpVM;
+	mpDatabase = rStatement.mpDatabase;
 	mBindNext = rStatement.mBindNext;
 	mEndOfRows = rStatement.mEndOfRows;
 	mResult = ResultRow(this);
 	mColsInResult = rStatement.mColsInResult;
+	mNumColumns = rStatement.mNumColumns;
+	mpColumns = rStatement.mpColumns;
+	mFullScanBase = rStatement.mFullScanBase;
+	mAutoIndexBase = rStatement.mAutoIndexBase;
+	mPlanReprepares = rStatement.mPlanReprepares;
+	mnTimeoutMs = rStatement.mnTimeoutMs;
+	mDeadlineMs = rStatement.mDeadlineMs;
+	mpCancellationToken = rStatement.mpCancellationToken;
+	mNeedsReset = rStatement.mNeedsReset;
+	mpParamNames = rStatement.mpParamNames;
 	// Important: the new object will now own the VM, so we must ensure
 	// rStatement doesn't finalize() the VM when it gets destroyed:
 	const_cast<SqlStatement&>(rStatement).mpVM = 0;
+	rStatement.mpColumns = 0;
+	rStatement.mpParamNames = 0;
 	return *this;
 }
 #ifdef _MSC_VER
@@ -104,19 +170,43 @@ SqlStatement& SqlStatement::operator=(const SqlStatement& rStatement) {
 
 void SqlStatement::destroy() {
 	mEndOfRows = true;
+	delete mpColumns;
+	mpColumns = 0;
+	delete mpParamNames;
+	mpParamNames = 0;
 	if (mpVM) {
 		sqlite3_finalize(mpVM);
 		mpVM = 0;
 	}
 }
 
+void SqlStatement::reset() {
+	if (!mpVM)
+		return;
+	sqlite3_reset(mpVM);
+	mNeedsReset = false;
+	mEndOfRows = true;
+	mColsInResult = 0;
+	mBindNext = 1;
+}
+
+void SqlStatement::finish() {
+	if (!mpVM)
+		return;
+	reset();
+	sqlite3_clear_bindings(mpVM);
+}
+
 inline void SqlStatement::onBind() {
 	// Internal method with the processing that must be done every time we bind() a value
 	require(mpVM);
 	if (mBindNext == 1) {
 		// If we are binding the first parameter (index 1, not 0), we need to reset the VM
-		// and clear any previous result info associated with this object
-		sqlite3_reset(mpVM);
+		// (unless run() or reset() already has) and clear any previous result info
+		if (mNeedsReset) {
+			sqlite3_reset(mpVM);
+			mNeedsReset = false;
+		}
 		mEndOfRows = true;
 		mColsInResult = 0;
 	}
@@ -173,20 +263,266 @@ SqlStatement &SqlStatement::bindSame() {
 	return *this;
 }
 
-SqlStatement &SqlStatement::execute() {
+SqlStatement &SqlStatement::bind(const SqlValue& value) {
+	switch (value.type()) {
+		case SQLITE_INTEGER: return bind(value.asInt64());
+		case SQLITE_FLOAT: return bind(value.asFloat());
+		case SQLITE_TEXT: return bind(value.asString().c_str());
+		case SQLITE_BLOB: return bind((const unsigned char*)value.asString().data(), (int)value.asString().size());
+		default: return bindNull();
+	}
+}
+
+namespace {
+struct ParamNameLess {
+	bool operator()(const std::pair<std::string, int>& a, const char* b) const { return strcmp(a.first.c_str(), b) < 0; }
+	bool operator()(const std::pair<std::string, int>& a, const std::pair<std::string, int>& b) const { return a.first < b.first; }
+};
+}
+
+int SqlStatement::numParams() const {
+	require(mpVM);
+	return sqlite3_bind_parameter_count(mpVM);
+}
+
+SqlStatement::ParamRef SqlStatement::param(const char* szName) const {
+	require(mpVM);
+	require(szName);
+	if (!mpParamNames) {
+		mpParamNames = new std::vector<std::pair<std::string, int> >();
+		const int nParams = sqlite3_bind_parameter_count(mpVM);
+		for (int i = 1; i <= nParams; i++) {
+			const char* szParam = sqlite3_bind_parameter_name(mpVM, i);
+			if (szParam) // Plain "?" parameters have no name
+				mpParamNames->push_back(std::make_pair(std::string(szParam), i));
+		}
+		std::sort(mpParamNames->begin(), mpParamNames->end(), ParamNameLess());
+	}
+	std::vector<std::pair<std::string, int> >::const_iterator it =
+		std::lower_bound(mpParamNames->begin(), mpParamNames->end(), szName, ParamNameLess());
+	if (it == mpParamNames->end() || it->first != szName)
+		throw SqlDatabaseException(std::string("No parameter named ").append(szName));
+	return ParamRef(it->second);
+}
+
+inline void SqlStatement::onNamedBind() {
+	require(mpVM);
+	if (mNeedsReset) {
+		// A running statement cannot be bound; this keeps the other parameters' values
+		sqlite3_reset(mpVM);
+		mNeedsReset = false;
+		mEndOfRows = true;
+		mColsInResult = 0;
+	}
+}
+
+SqlStatement &SqlStatement::bind(ParamRef param, const char* szValue) {
+	onNamedBind();
+	if (sqlite3_bind_text(mpVM, param.mIndex, szValue, -1, SQLITE_TRANSIENT) != SQLITE_OK)
+		throw SqlDatabaseException("Error binding string param.");
+	return *this;
+}
+
+SqlStatement &SqlStatement::bind(ParamRef param, const int nValue) {
+	onNamedBind();
+	if (sqlite3_bind_int(mpVM, param.mIndex, nValue) != SQLITE_OK)
+		throw SqlDatabaseException("Error binding int param");
+	return *this;
+}
+
+SqlStatement &SqlStatement::bind(ParamRef param, const int64_t nValue) {
+	onNamedBind();
+	if (sqlite3_bind_int64(mpVM, param.mIndex, nValue) != SQLITE_OK)
+		throw SqlDatabaseException("Error binding int param");
+	return *this;
+}
+
+SqlStatement &SqlStatement::bind(ParamRef param, const double dValue) {
+	onNamedBind();
+	if (sqlite3_bind_double(mpVM, param.mIndex, dValue) != SQLITE_OK)
+		throw SqlDatabaseException("Error binding double param");
+	return *this;
+}
+
+SqlStatement &SqlStatement::bind(ParamRef param, const unsigned char* blobValue, int nLen) {
+	onNamedBind();
+	if (sqlite3_bind_blob(mpVM, param.mIndex, (const void*)blobValue, nLen, SQLITE_TRANSIENT) != SQLITE_OK)
+		throw SqlDatabaseException("Error binding blob param");
+	return *this;
+}
+
+SqlStatement &SqlStatement::bind(ParamRef param, const SqlValue& value) {
+	onNamedBind();
+	if (bindAt(param.mIndex, value) != SQLITE_OK)
+		throw SqlDatabaseException("Error binding param");
+	return *this;
+}
+
+SqlStatement &SqlStatement::bindNull(ParamRef param) {
+	onNamedBind();
+	if (sqlite3_bind_null(mpVM, param.mIndex) != SQLITE_OK)
+		throw SqlDatabaseException("Error binding NULL param");
+	return *this;
+}
+
+void SqlStatement::beginBindAll(int nValues) {
+	require(mpVM);
+	if (mNeedsReset) {
+		sqlite3_reset(mpVM);
+		mNeedsReset = false;
+	}
+	mEndOfRows = true;
+	mColsInResult = 0;
+	const int nParams = sqlite3_bind_parameter_count(mpVM);
+	if (nValues != nParams) {
+		std::ostringstream msg;
+		msg << "bindAll() was given " << nValues << " values for a statement with " << nParams << " parameters.";
+		throw SqlDatabaseException(msg.str());
+	}
+	mBindNext = nValues + 1;
+}
+
+void SqlStatement::endBindAll(int result) {
+	if (result != SQLITE_OK)
+		throw SqlDatabaseException("Error binding params");
+}
+
+int SqlStatement::bindInt64At(int index, int64_t nValue) { return sqlite3_bind_int64(mpVM, index, nValue); }
+int SqlStatement::bindDoubleAt(int index, double dValue) { return sqlite3_bind_double(mpVM, index, dValue); }
+int SqlStatement::bindTextAt(int index, const char* szValue, int nLen) { return sqlite3_bind_text(mpVM, index, szValue, nLen, SQLITE_TRANSIENT); }
+int SqlStatement::bindNullAt(int index) { return sqlite3_bind_null(mpVM, index); }
+
+int SqlStatement::bindAt(int index, const SqlValue& value) {
+	switch (value.type()) {
+		case SQLITE_INTEGER: return bindInt64At(index, value.asInt64());
+		case SQLITE_FLOAT: return bindDoubleAt(index, value.asFloat());
+		case SQLITE_TEXT: return bindTextAt(index, value.asString().data(), (int)value.asString().size());
+		case SQLITE_BLOB: return sqlite3_bind_blob(mpVM, index, value.asString().data(), (int)value.asString().size(), SQLITE_TRANSIENT);
+		default: return bindNullAt(index);
+	}
+}
+
+int SqlStatement::step() {
+	mNeedsReset = true;
+	const bool limited = mpDatabase && (mDeadlineMs || mpCancellationToken);
+	const SqlStatement* pOuter = 0;
+	if (limited) {
+		// A cheap step may finish before the progress handler is ever called, so check first
+		const int reason = limitExceeded();
+		if (reason) {
+			sqlite3_reset(mpVM);
+			mEndOfRows = true;
+			ThrowAbortException(reason);
+		}
+		mpDatabase->enableProgressChecks();
+		pOuter = mpDatabase->mpLimitedStatement; // In case this is stepped from within another statement
+		mpDatabase->mpLimitedStatement = this;
+		mpDatabase->mAbortReason = 0;
+	}
+	const bool inTransaction = limited && !sqlite3_get_autocommit(mpDatabase->mpDB);
+	const int result = sqlite3_step(mpVM);
+	if (limited) {
+		mpDatabase->mpLimitedStatement = pOuter;
+		const int reason = mpDatabase->mAbortReason;
+		mpDatabase->mAbortReason = 0;
+		if (result == SQLITE_INTERRUPT && reason) {
+			sqlite3_reset(mpVM);
+			mEndOfRows = true;
+			// SQLite may have rolled back the explicit transaction the statement ran in
+			ThrowAbortException(reason, inTransaction && sqlite3_get_autocommit(mpDatabase->mpDB));
+		}
+	}
+	if (mpDatabase) {
+		mpDatabase->deliverChanges(); // In case this step committed a transaction
+		if (result == SQLITE_DONE && mpDatabase->mpStatementWarningHandler)
+			checkStatementWarnings();
+	}
+	return result;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+void SqlCancellationToken::cancel() { __atomic_store_n(&mCancelled, 1, __ATOMIC_RELEASE); }
+void SqlCancellationToken::reset() { __atomic_store_n(&mCancelled, 0, __ATOMIC_RELEASE); }
+bool SqlCancellationToken::isCancelled() const { return __atomic_load_n(&mCancelled, __ATOMIC_ACQUIRE) != 0; }
+#else
+// Visual C++ gives volatile accesses acquire and release semantics
+void SqlCancellationToken::cancel() { mCancelled = 1; }
+void SqlCancellationToken::reset() { mCancelled = 0; }
+bool SqlCancellationToken::isCancelled() const { return mCancelled != 0; }
+#endif
+
+int SqlStatement::limitExceeded() const {
+	if (mpCancellationToken && mpCancellationToken->isCancelled())
+		return ABORT_CANCELLED;
+	if (mDeadlineMs && MonotonicMs() >= mDeadlineMs)
+		return ABORT_TIMEOUT;
+	return 0;
+}
+
+void SqlStatement::setTimeout(int nMillisecs) {
+	require(mpDatabase); // Limits are enforced through the database's progress handler
+	mnTimeoutMs = nMillisecs > 0 ? nMillisecs : 0;
+}
+
+void SqlStatement::checkStatementWarnings() {
+	const SqlDatabase& db = *mpDatabase;
+	const int fullScanSteps = sqlite3_stmt_status(mpVM, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0) - mFullScanBase;
+	const int autoIndexRows = sqlite3_stmt_status(mpVM, SQLITE_STMTSTATUS_AUTOINDEX, 0) - mAutoIndexBase;
+	if ((db.mnWarnFullScanSteps > 0 && fullScanSteps >= db.mnWarnFullScanSteps) ||
+		(db.mnWarnAutoIndexRows > 0 && autoIndexRows >= db.mnWarnAutoIndexRows))
+	{
+		SqlStatementStats runStats = stats();
+		runStats.fullScanSteps = fullScanSteps;
+		runStats.autoIndexRows = autoIndexRows;
+		db.mpStatementWarningHandler(db.mpStatementWarningArg, sqlite3_sql(mpVM), runStats);
+	}
+}
+
+SqlStatementStats SqlStatement::stats(bool resetCounters) const {
+	require(mpVM);
+	const int reset = resetCounters ? 1 : 0;
+	SqlStatementStats result;
+	result.fullScanSteps = sqlite3_stmt_status(mpVM, SQLITE_STMTSTATUS_FULLSCAN_STEP, reset);
+	result.sorts = sqlite3_stmt_status(mpVM, SQLITE_STMTSTATUS_SORT, reset);
+	result.autoIndexRows = sqlite3_stmt_status(mpVM, SQLITE_STMTSTATUS_AUTOINDEX, reset);
+	result.vmSteps = sqlite3_stmt_status(mpVM, SQLITE_STMTSTATUS_VM_STEP, reset);
+#ifdef SQLITE_STMTSTATUS_MEMUSED // Added in SQLite 3.20.0
+	result.reprepares = sqlite3_stmt_status(mpVM, SQLITE_STMTSTATUS_REPREPARE, reset);
+	result.runs = sqlite3_stmt_status(mpVM, SQLITE_STMTSTATUS_RUN, reset);
+	result.memoryUsed = sqlite3_stmt_status(mpVM, SQLITE_STMTSTATUS_MEMUSED, 0);
+#else
+	result.reprepares = result.runs = result.memoryUsed = 0;
+#endif
+	return result;
+}
+
+void SqlStatement::startRun() {
 	require(mpVM);
 	mBindNext = 1; // Next call to bind() should replace the first parameter (it's not zero-indexed)
 	if (!mEndOfRows)
 		sqlite3_reset(mpVM); // User wants to reset the query even though we haven't finished going through all rows...
+	if (mpDatabase && mpDatabase->mpStatementWarningHandler) {
+		mFullScanBase = sqlite3_stmt_status(mpVM, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0);
+		mAutoIndexBase = sqlite3_stmt_status(mpVM, SQLITE_STMTSTATUS_AUTOINDEX, 0);
+	}
+	mDeadlineMs = mnTimeoutMs ? MonotonicMs() + mnTimeoutMs : 0;
+}
 
-	const int result = sqlite3_step(mpVM);
+SqlStatement &SqlStatement::execute() {
+	startRun();
+	const int result = step();
+	if (mpDatabase && mpDatabase->mpPlanChangeHandler && (result == SQLITE_ROW || result == SQLITE_DONE))
+		checkQueryPlan(); // After stepping, since that is when SQLite re-prepares a statement
 	if (result == SQLITE_DONE) {
 		mEndOfRows = true; // No rows were returned
 		mColsInResult = 0;
 		return *this;
 	} else if (result == SQLITE_ROW) {
 		mEndOfRows = false; // At least one row was returned
-		mColsInResult = sqlite3_column_count(mpVM);
+		refreshColumns();
+		mColsInResult = mNumColumns;
+		if (mpDatabase && mpDatabase->mTrackOpenStatements)
+			mpDatabase->recordOpenStatement(mpVM);
 		return *this;
 	} else {
 		ThrowStatusCodeException(result, mpVM);
@@ -194,18 +530,54 @@ SqlStatement &SqlStatement::execute() {
 	}
 }
 
+SqlWriteResult SqlStatement::run() {
+	startRun();
+	const int result = step();
+	if (mpDatabase && mpDatabase->mpPlanChangeHandler && (result == SQLITE_ROW || result == SQLITE_DONE))
+		checkQueryPlan();
+	SqlWriteResult written;
+	sqlite3* pDB = sqlite3_db_handle(mpVM);
+	written.changes = sqlite3_changes(pDB);
+	written.lastRowId = sqlite3_last_insert_rowid(pDB);
+	// Reset straight away, so that any locks are released now, and the next bind() need not
+	sqlite3_reset(mpVM);
+	mNeedsReset = false;
+	mEndOfRows = true;
+	mColsInResult = 0;
+	if (result != SQLITE_DONE && result != SQLITE_ROW)
+		ThrowStatusCodeException(result, mpVM); // sqlite3_reset() keeps the error message
+	return written;
+}
+
 const SqlStatement::ResultRow& SqlStatement::currentRow() const {
 	require(mpVM);
 	if (mEndOfRows){ throw SqlDatabaseException("called currentRow() after reaching end of rows"); }
 	return mResult;
 }
 
+void SqlStatement::advance() {
+	const int result = step();
+	if (result == SQLITE_ROW)
+		return;
+	mEndOfRows = true;
+	if (result != SQLITE_DONE)
+		ThrowStatusCodeException(result, mpVM);
+}
+
+void SqlStatement::checkColumnCount(int nColumns) const {
+	if (!mEndOfRows && mColsInResult < nColumns) {
+		std::ostringstream msg;
+		msg << "as<>() asked for " << nColumns << " columns, but the statement returns " << mColsInResult << ".";
+		throw SqlDatabaseException(msg.str());
+	}
+}
+
 bool SqlStatement::nextRow() {
 	require(mpVM);
 	if (mEndOfRows)
 		return false;// Already at the last row.
 	
-	const int result = sqlite3_step(mpVM);
+	const int result = step();
 	if (result == SQLITE_DONE) {
 		mEndOfRows = true; // No rows were returned
 	} else if (result == SQLITE_ROW) {
@@ -218,6 +590,440 @@ bool SqlStatement::nextRow() {
 }
 
 
+const SqlColumnMetadata& SqlStatement::columns() const {
+	require(mpVM);
+	if (mpColumns) {
+#ifdef SQLITE_STMTSTATUS_REPREPARE
+		// A statement like "SELECT *" can change shape if SQLite re-prepares it after a schema change
+		if (sqlite3_stmt_status(mpVM, SQLITE_STMTSTATUS_REPREPARE, 0) == mpColumns->mReprepares)
+			return *mpColumns;
+		delete mpColumns;
+		mpColumns = 0;
+		mNumColumns = sqlite3_column_count(mpVM);
+		if (!mEndOfRows)
+			const_cast<SqlStatement*>(this)->mColsInResult = mNumColumns;
+#else
+		return *mpColumns;
+#endif
+	}
+	mpColumns = new SqlColumnMetadata(mpVM);
+	return *mpColumns;
+}
+
+void SqlStatement::refreshColumns() const {
+	// SQLite re-prepares a statement after a schema change (when it is first stepped), and
+	// a statement like "SELECT *" can then return a different number of columns
+	if (mpColumns)
+		columns(); // Rebuilds the metadata and column count if the statement was re-prepared
+	else
+		mNumColumns = sqlite3_column_count(mpVM);
+}
+
+SqlColumnMetadata::SqlColumnMetadata(sqlite3_stmt* pVM) {
+#ifdef SQLITE_STMTSTATUS_REPREPARE
+	mReprepares = sqlite3_stmt_status(pVM, SQLITE_STMTSTATUS_REPREPARE, 0);
+#else
+	mReprepares = 0;
+#endif
+	const int nCols = sqlite3_column_count(pVM);
+	const int nStrings = 5;
+	// Copy every string into one buffer, recording offsets (or -1 for NULL), then point into it.
+	std::vector<long> offsets;
+	offsets.reserve(nCols * nStrings);
+	for (int i = 0; i < nCols; i++) {
+		const char* strings[nStrings] = {
+			sqlite3_column_name(pVM, i),
+			sqlite3_column_decltype(pVM, i),
+#ifdef SQLITE_ENABLE_COLUMN_METADATA
+			sqlite3_column_database_name(pVM, i),
+			sqlite3_column_table_name(pVM, i),
+			sqlite3_column_origin_name(pVM, i),
+#else
+			0, 0, 0,
+#endif
+		};
+		for (int j = 0; j < nStrings; j++) {
+			if (!strings[j]) {
+				offsets.push_back(-1);
+				continue;
+			}
+			offsets.push_back((long)mStrings.size());
+			mStrings.append(strings[j]).push_back('\0');
+		}
+	}
+	mColumns.resize(nCols);
+	const char* pBase = mStrings.c_str();
+	for (int i = 0; i < nCols; i++) {
+		const char** fields[nStrings] = { &mColumns[i].name, &mColumns[i].declType,
+			&mColumns[i].databaseName, &mColumns[i].tableName, &mColumns[i].originName };
+		for (int j = 0; j < nStrings; j++) {
+			const long offset = offsets[i * nStrings + j];
+			*fields[j] = (offset < 0) ? 0 : pBase + offset;
+		}
+	}
+}
+
+const SqlColumnInfo& SqlColumnMetadata::column(int nColumn) const {
+	if (nColumn < 0 || nColumn >= (int)mColumns.size())
+		throw SqlDatabaseException("Invalid column index.");
+	return mColumns[nColumn];
+}
+
+int SqlColumnMetadata::indexOf(const char* szName) const {
+	for (size_t i = 0; i < mColumns.size(); i++) {
+		if (strcmp(szName, mColumns[i].name) == 0)
+			return (int)i;
+	}
+	return -1;
+}
+
+bool SqlStatement::isReadOnly() const {
+	require(mpVM);
+	return sqlite3_stmt_readonly(mpVM) != 0;
+}
+
+SqlQueryPlan SqlStatement::queryPlan() const {
+	require(mpVM);
+	std::vector<SqlQueryPlanNode> rows; // As returned by SQLite, before building the tree
+
+	sqlite3* pDB = sqlite3_db_handle(mpVM);
+	const std::string sql = std::string("EXPLAIN QUERY PLAN ").append(sqlite3_sql(mpVM));
+	sqlite3_stmt* pExplain = 0;
+	int result = sqlite3_prepare_v2(pDB, sql.c_str(), -1, &pExplain, 0);
+	if (result != SQLITE_OK)
+		ThrowStatusCodeException(result, pDB);
+	// SQLite 3.24+ returns (id, parent, notused, detail); older versions have no tree structure.
+	const bool hasTree = (strcmp(sqlite3_column_name(pExplain, 0), "id") == 0);
+	while ((result = sqlite3_step(pExplain)) == SQLITE_ROW) {
+		SqlQueryPlanNode row;
+		row.id = hasTree ? sqlite3_column_int(pExplain, 0) : (int)rows.size() + 1;
+		row.parentId = hasTree ? sqlite3_column_int(pExplain, 1) : 0;
+		const char* szDetail = (const char*)sqlite3_column_text(pExplain, 3);
+		row.detail = szDetail ? szDetail : "";
+		rows.push_back(row);
+	}
+	sqlite3_finalize(pExplain);
+	if (result != SQLITE_DONE)
+		ThrowStatusCodeException(result, pDB);
+
+	// Assemble the tree. Children always follow their parent, so one pass with a stack of
+	// the path to the most recent node is enough.
+	SqlQueryPlan plan;
+	std::vector<SqlQueryPlanNode*> path;
+	for (size_t i = 0; i < rows.size(); i++) {
+		while (!path.empty() && path.back()->id != rows[i].parentId)
+			path.pop_back();
+		std::vector<SqlQueryPlanNode>& siblings = path.empty() ? plan.mRoots : path.back()->children;
+		siblings.push_back(rows[i]);
+		if (path.empty())
+			siblings.back().parentId = 0;
+		path.push_back(&siblings.back());
+	}
+	return plan;
+}
+
+void SqlStatement::checkQueryPlan() {
+#ifdef SQLITE_STMTSTATUS_REPREPARE
+	const int reprepares = sqlite3_stmt_status(mpVM, SQLITE_STMTSTATUS_REPREPARE, 0);
+#else
+	const int reprepares = 0;
+#endif
+	if (reprepares == mPlanReprepares)
+		return; // Already checked, and SQLite has not re-planned it since
+	mPlanReprepares = reprepares;
+	const SqlQueryPlan plan = queryPlan();
+	SqlDatabase& db = *mpDatabase;
+	const char* szSQL = sqlite3_sql(mpVM);
+	std::map<std::string, SqlQueryPlan>::iterator known = db.mKnownPlans.find(szSQL);
+	if (known == db.mKnownPlans.end()) {
+		db.mKnownPlans[szSQL] = plan;
+	} else if (known->second != plan) {
+		const SqlQueryPlan oldPlan = known->second;
+		known->second = plan;
+		db.mpPlanChangeHandler(db.mpPlanChangeArg, szSQL, oldPlan, plan);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void appendPlanNodes(std::string& out, const std::vector<SqlQueryPlanNode>& nodes, int depth) {
+	for (size_t i = 0; i < nodes.size(); i++) {
+		out.append(2 * depth, ' ').append(nodes[i].detail).append("\n");
+		appendPlanNodes(out, nodes[i].children, depth + 1);
+	}
+}
+
+static int countPlanScans(const std::vector<SqlQueryPlanNode>& nodes) {
+	int nScans = 0;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		const std::string& detail = nodes[i].detail;
+		if (detail.compare(0, 5, "SCAN ") == 0 && detail.compare(0, 17, "SCAN CONSTANT ROW") != 0)
+			nScans++;
+		nScans += countPlanScans(nodes[i].children);
+	}
+	return nScans;
+}
+
+std::string SqlQueryPlan::toString() const {
+	std::string result;
+	appendPlanNodes(result, mRoots, 0);
+	return result;
+}
+
+int SqlQueryPlan::numFullScans() const {
+	return countPlanScans(mRoots);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Writes the JSON escape sequence for c to szOut and returns its length, or returns 0
+// if c needs no escaping
+static int JsonEscape(unsigned char c, char* szOut) {
+	static const char hex[] = "0123456789abcdef";
+	if (c >= 0x20 && c != '"' && c != '\\')
+		return 0;
+	szOut[0] = '\\';
+	switch (c) {
+		case '"': szOut[1] = '"'; return 2;
+		case '\\': szOut[1] = '\\'; return 2;
+		case '\n': szOut[1] = 'n'; return 2;
+		case '\r': szOut[1] = 'r'; return 2;
+		case '\t': szOut[1] = 't'; return 2;
+		case '\b': szOut[1] = 'b'; return 2;
+		case '\f': szOut[1] = 'f'; return 2;
+		default:
+			szOut[1] = 'u';
+			szOut[2] = szOut[3] = '0';
+			szOut[4] = hex[c >> 4];
+			szOut[5] = hex[c & 0xf];
+			return 6;
+	}
+}
+
+// Fixed-size output buffer used by the export methods, so that exporting does not
+// allocate per row or per field no matter how large the result set is.
+class SqlExportWriter {
+public:
+	explicit SqlExportWriter(std::ostream* pStream) : mpStream(pStream), mFd(-1), mUsed(0) {}
+	explicit SqlExportWriter(int fd) : mpStream(0), mFd(fd), mUsed(0) {}
+
+	void put(char c) {
+		if (mUsed == sizeof(mBuffer))
+			flush();
+		mBuffer[mUsed++] = c;
+	}
+	void put(const char* pData, size_t nLen) {
+		if (nLen > sizeof(mBuffer) - mUsed) {
+			flush();
+			if (nLen > sizeof(mBuffer)) {
+				writeOut(pData, nLen);
+				return;
+			}
+		}
+		memcpy(mBuffer + mUsed, pData, nLen);
+		mUsed += nLen;
+	}
+	void put(const char* sz) { put(sz, strlen(sz)); }
+	void putInt(sqlite3_int64 n) {
+		char digits[24];
+		char* p = digits + sizeof(digits);
+		sqlite3_uint64 u = (n < 0) ? (sqlite3_uint64)0 - (sqlite3_uint64)n : (sqlite3_uint64)n;
+		do {
+			*--p = (char)('0' + (u % 10));
+			u /= 10;
+		} while (u);
+		if (n < 0)
+			*--p = '-';
+		put(p, digits + sizeof(digits) - p);
+	}
+	void putFloat(double d) {
+		// Same formatting SQLite uses when converting a REAL to text:
+		char text[40];
+		sqlite3_snprintf(sizeof(text), text, "%!.15g", d);
+		put(text);
+	}
+	void putHex(const unsigned char* pData, int nLen) {
+		static const char hex[] = "0123456789abcdef";
+		for (int i = 0; i < nLen; i++) {
+			put(hex[pData[i] >> 4]);
+			put(hex[pData[i] & 0xf]);
+		}
+	}
+	void putCsvText(const char* pText, int nLen) {
+		bool needsQuotes = false;
+		for (int i = 0; i < nLen && !needsQuotes; i++) {
+			const char c = pText[i];
+			needsQuotes = (c == ',' || c == '"' || c == '\n' || c == '\r');
+		}
+		if (!needsQuotes) {
+			put(pText, nLen);
+			return;
+		}
+		put('"');
+		for (int i = 0; i < nLen; i++) {
+			if (pText[i] == '"')
+				put('"');
+			put(pText[i]);
+		}
+		put('"');
+	}
+	void putJsonString(const char* pText, int nLen) {
+		put('"');
+		int runStart = 0; // Copy runs of characters that need no escaping in one go
+		char escape[6];
+		for (int i = 0; i < nLen; i++) {
+			const int nEscape = JsonEscape((unsigned char)pText[i], escape);
+			if (!nEscape)
+				continue;
+			put(pText + runStart, i - runStart);
+			runStart = i + 1;
+			put(escape, nEscape);
+		}
+		put(pText + runStart, nLen - runStart);
+		put('"');
+	}
+
+	void flush() {
+		if (mUsed) {
+			writeOut(mBuffer, mUsed);
+			mUsed = 0;
+		}
+	}
+private:
+	void writeOut(const char* pData, size_t nLen) {
+		if (mpStream) {
+			mpStream->write(pData, (std::streamsize)nLen);
+			if (!*mpStream)
+				throw SqlDatabaseException("Error writing exported rows to stream.");
+			return;
+		}
+		while (nLen > 0) {
+#ifdef _WIN32
+			const int written = _write(mFd, pData, (unsigned int)nLen);
+#else
+			const ssize_t written = write(mFd, pData, nLen);
+#endif
+			if (written < 0) {
+				if (errno == EINTR)
+					continue;
+				throw SqlDatabaseException("Error writing exported rows to file descriptor.");
+			}
+			pData += written;
+			nLen -= (size_t)written;
+		}
+	}
+
+	std::ostream* mpStream;
+	int mFd;
+	size_t mUsed;
+	char mBuffer[64 * 1024];
+};
+
+int64_t SqlStatement::exportRows(SqlExportWriter& writer, bool json, bool includeHeader) {
+	const SqlColumnMetadata& cols = columns();
+	const int nCols = cols.numColumns();
+	std::vector<std::string> jsonKeys;
+	if (json) {
+		// Escape the column names once, rather than for every row:
+		for (int i = 0; i < nCols; i++) {
+			const char* szName = cols.column(i).name;
+			std::string key(i == 0 ? "{" : ",");
+			key.append("\"");
+			char escape[6];
+			for (const char* p = szName; *p; p++) {
+				const int nEscape = JsonEscape((unsigned char)*p, escape);
+				if (nEscape)
+					key.append(escape, nEscape);
+				else
+					key.push_back(*p);
+			}
+			key.append("\":");
+			jsonKeys.push_back(key);
+		}
+	} else if (includeHeader) {
+		for (int i = 0; i < nCols; i++) {
+			if (i)
+				writer.put(',');
+			const char* szName = cols.column(i).name;
+			writer.putCsvText(szName, (int)strlen(szName));
+		}
+		writer.put("\r\n", 2);
+	}
+
+	int64_t nRows = 0;
+	for (; !mEndOfRows; nextRow()) {
+		for (int i = 0; i < nCols; i++) {
+			if (json)
+				writer.put(jsonKeys[i].data(), jsonKeys[i].size());
+			else if (i)
+				writer.put(',');
+			switch (sqlite3_column_type(mpVM, i)) {
+				case SQLITE_INTEGER:
+					writer.putInt(sqlite3_column_int64(mpVM, i));
+					break;
+				case SQLITE_FLOAT: {
+					const double d = sqlite3_column_double(mpVM, i);
+					if (json && !(d - d == 0.0))
+						writer.put("null", 4); // JSON has no representation for Inf or NaN
+					else
+						writer.putFloat(d);
+					break;
+				}
+				case SQLITE_TEXT: {
+					const char* pText = (const char*)sqlite3_column_text(mpVM, i);
+					const int nLen = sqlite3_column_bytes(mpVM, i);
+					if (json)
+						writer.putJsonString(pText, nLen);
+					else
+						writer.putCsvText(pText, nLen);
+					break;
+				}
+				case SQLITE_BLOB: {
+					const unsigned char* pBlob = (const unsigned char*)sqlite3_column_blob(mpVM, i);
+					const int nLen = sqlite3_column_bytes(mpVM, i);
+					if (json)
+						writer.put('"');
+					writer.putHex(pBlob, nLen);
+					if (json)
+						writer.put('"');
+					break;
+				}
+				default: // SQLITE_NULL
+					if (json)
+						writer.put("null", 4);
+					break;
+			}
+		}
+		if (json)
+			writer.put(nCols ? "}\n" : "{}\n");
+		else
+			writer.put("\r\n", 2);
+		nRows++;
+	}
+	writer.flush();
+	return nRows;
+}
+
+int64_t SqlStatement::exportCsv(std::ostream& out, bool includeHeader) {
+	SqlExportWriter writer(&out);
+	return exportRows(writer, false, includeHeader);
+}
+
+int64_t SqlStatement::exportCsv(int fd, bool includeHeader) {
+	SqlExportWriter writer(fd);
+	return exportRows(writer, false, includeHeader);
+}
+
+int64_t SqlStatement::exportJsonLines(std::ostream& out) {
+	SqlExportWriter writer(&out);
+	return exportRows(writer, true, false);
+}
+
+int64_t SqlStatement::exportJsonLines(int fd) {
+	SqlExportWriter writer(fd);
+	return exportRows(writer, true, false);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 int SqlStatement::ResultRow::numFields() const {
@@ -295,15 +1101,86 @@ const unsigned char* SqlStatement::ResultRow::getBlobField(const char* szField,
 	return getBlobField(fieldIndex(szField), nLen);
 }
 
+#if CPP_SQL_WRAPPER_CPLUSPLUS >= 201703L
+std::string_view SqlStatement::ResultRow::getStringView(int nField) const {
+	require(mpParent->mpVM);
+	checkIndex(nField);
+	// Get the text before its length, so the length is of the UTF-8 conversion if one is needed
+	const char* pText = (const char*)sqlite3_column_text(mpParent->mpVM, nField);
+	if (!pText)
+		return std::string_view();
+	return std::string_view(pText, (size_t)sqlite3_column_bytes(mpParent->mpVM, nField));
+}
+#endif
+
+#if CPP_SQL_WRAPPER_CPLUSPLUS >= 201703L
+std::string_view SqlStatement::ResultRow::getStringViewUnchecked(int nField) const {
+	const char* pText = (const char*)sqlite3_column_text(mpParent->mpVM, nField);
+	if (!pText)
+		return std::string_view();
+	return std::string_view(pText, (size_t)sqlite3_column_bytes(mpParent->mpVM, nField));
+}
+#endif
+
+#if defined(__cpp_lib_span)
+std::span<const unsigned char> SqlStatement::ResultRow::getBlobSpan(int nField) const {
+	require(mpParent->mpVM);
+	checkIndex(nField);
+	const unsigned char* pData = (const unsigned char*)sqlite3_column_blob(mpParent->mpVM, nField);
+	if (!pData)
+		return std::span<const unsigned char>();
+	return std::span<const unsigned char>(pData, (size_t)sqlite3_column_bytes(mpParent->mpVM, nField));
+}
+#endif
+
+int SqlStatement::ResultRow::getIntUnchecked(int nField) const {
+	return sqlite3_column_int(mpParent->mpVM, nField);
+}
+
+int SqlStatement::ResultRow::getIntUnchecked(int nField, int nNullValue) const {
+	sqlite3_stmt* pVM = mpParent->mpVM;
+	return (sqlite3_column_type(pVM, nField) == SQLITE_NULL) ? nNullValue : sqlite3_column_int(pVM, nField);
+}
+
+int64_t SqlStatement::ResultRow::getInt64Unchecked(int nField) const {
+	return sqlite3_column_int64(mpParent->mpVM, nField);
+}
+
+int64_t SqlStatement::ResultRow::getInt64Unchecked(int nField, int64_t nNullValue) const {
+	sqlite3_stmt* pVM = mpParent->mpVM;
+	return (sqlite3_column_type(pVM, nField) == SQLITE_NULL) ? nNullValue : sqlite3_column_int64(pVM, nField);
+}
+
+double SqlStatement::ResultRow::getFloatUnchecked(int nField) const {
+	return sqlite3_column_double(mpParent->mpVM, nField);
+}
+
+double SqlStatement::ResultRow::getFloatUnchecked(int nField, double fNullValue) const {
+	sqlite3_stmt* pVM = mpParent->mpVM;
+	return (sqlite3_column_type(pVM, nField) == SQLITE_NULL) ? fNullValue : sqlite3_column_double(pVM, nField);
+}
+
+const char* SqlStatement::ResultRow::getStringUnchecked(int nField) const {
+	return (const char*)sqlite3_column_text(mpParent->mpVM, nField);
+}
+
+const char* SqlStatement::ResultRow::getStringUnchecked(int nField, const char* szNullValue) const {
+	// sqlite3_column_text() already returns NULL for a NULL value, so no type check is needed
+	const char* szValue = (const char*)sqlite3_column_text(mpParent->mpVM, nField);
+	return szValue ? szValue : szNullValue;
+}
+
+SqlType SqlStatement::ResultRow::fieldDataTypeUnchecked(int nField) const {
+	return (SqlType)sqlite3_column_type(mpParent->mpVM, nField);
+}
+
 int SqlStatement::ResultRow::fieldIndex(const char* szField) const {
 	require(mpParent->mpVM);
 	assert(szField != 0);
 
-	for (int nField = 0; nField < mpParent->mColsInResult; nField++)	{
-		if (strcmp(szField, sqlite3_column_name(mpParent->mpVM, nField)) == 0) {
-			return nField;
-		}
-	}
+	const int nField = mpParent->columns().indexOf(szField);
+	if (nField >= 0 && nField < mpParent->mColsInResult)
+		return nField;
 	throw SqlDatabaseException("Invalid field name requested");
 }
 
@@ -311,14 +1188,14 @@ int SqlStatement::ResultRow::fieldIndex(const char* szField) const {
 const char* SqlStatement::ResultRow::fieldName(int nField) const {
 	require(mpParent->mpVM);
 	checkIndex(nField);
-	return sqlite3_column_name(mpParent->mpVM, nField);
+	return mpParent->columns().column(nField).name;
 }
 
 
 const char* SqlStatement::ResultRow::fieldDeclType(int nField) const {
 	require(mpParent->mpVM);
 	checkIndex(nField);
-	return sqlite3_column_decltype(mpParent->mpVM, nField);
+	return mpParent->columns().column(nField).declType;
 }
 
 
@@ -330,9 +1207,192 @@ SqlType SqlStatement::ResultRow::fieldDataType(int nField) const {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+SqlValue SqlValue::blob(const unsigned char* blobValue, int nLen) {
+	SqlValue value;
+	value.mType = (SqlType)SQLITE_BLOB;
+	value.mText.assign((const char*)blobValue, nLen);
+	return value;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int SqlResultSet::appendRows(SqlStatement& rStatement, int maxRows) {
+	require(rStatement.mpVM);
+	sqlite3_stmt* pVM = rStatement.mpVM;
+	const SqlColumnMetadata& cols = rStatement.columns();
+	const int nCols = cols.numColumns();
+	if (mNames.empty()) {
+		for (int i = 0; i < nCols; i++)
+			mNames.push_back(cols.column(i).name);
+	} else if ((int)mNames.size() != nCols) {
+		throw SqlDatabaseException("appendRows() called with a statement that has a different number of columns.");
+	}
+
+	int nAdded = 0;
+	for (; rStatement.hasRow() && (maxRows < 0 || nAdded < maxRows); rStatement.nextRow()) {
+		for (int i = 0; i < nCols; i++) {
+			Cell c;
+			c.type = sqlite3_column_type(pVM, i);
+			c.len = 0;
+			switch (c.type) {
+				case SQLITE_INTEGER:
+					c.value.i = sqlite3_column_int64(pVM, i);
+					break;
+				case SQLITE_FLOAT:
+					c.value.d = sqlite3_column_double(pVM, i);
+					break;
+				case SQLITE_TEXT:
+				case SQLITE_BLOB: {
+					const char* pData = (c.type == SQLITE_TEXT) ? (const char*)sqlite3_column_text(pVM, i) : (const char*)sqlite3_column_blob(pVM, i);
+					c.len = sqlite3_column_bytes(pVM, i);
+					c.value.offset = mData.size();
+					mData.append(pData ? pData : "", c.len);
+					mData.push_back('\0');
+					break;
+				}
+				default:
+					c.value.i = 0;
+			}
+			mCells.push_back(c);
+		}
+		mNumRows++;
+		nAdded++;
+	}
+	return nAdded;
+}
+
+void SqlResultSet::clear() {
+	mNames.clear();
+	mCells.clear();
+	mData.clear();
+	mNumRows = 0;
+}
+
+void SqlResultSet::swap(SqlResultSet& rOther) {
+	mNames.swap(rOther.mNames);
+	mCells.swap(rOther.mCells);
+	mData.swap(rOther.mData);
+	std::swap(mNumRows, rOther.mNumRows);
+}
+
+const char* SqlResultSet::fieldName(int nField) const {
+	if (nField < 0 || nField >= (int)mNames.size())
+		throw SqlDatabaseException("Invalid column index.");
+	return mNames[nField].c_str();
+}
+
+size_t SqlResultSet::memoryUsed() const {
+	size_t nBytes = sizeof(*this) + mCells.capacity() * sizeof(Cell) + mData.capacity();
+	for (size_t i = 0; i < mNames.size(); i++)
+		nBytes += sizeof(std::string) + mNames[i].capacity();
+	return nBytes;
+}
+
+const SqlResultSet::Cell& SqlResultSet::cell(int nRow, int nField) const {
+	if (nRow < 0 || nRow >= mNumRows)
+		throw SqlDatabaseException("Invalid row index.");
+	if (nField < 0 || nField >= (int)mNames.size())
+		throw SqlDatabaseException("Invalid column index.");
+	return mCells[(size_t)nRow * mNames.size() + nField];
+}
+
+int64_t SqlResultSet::getInt64Field(int nRow, int nField, int64_t nNullValue) const {
+	const Cell& c = cell(nRow, nField);
+	switch (c.type) {
+		case SQLITE_INTEGER: return c.value.i;
+		case SQLITE_FLOAT: return (int64_t)c.value.d;
+		case SQLITE_NULL: return nNullValue;
+		default: return strtoll(mData.c_str() + c.value.offset, 0, 10);
+	}
+}
+
+double SqlResultSet::getFloatField(int nRow, int nField, double fNullValue) const {
+	const Cell& c = cell(nRow, nField);
+	switch (c.type) {
+		case SQLITE_INTEGER: return (double)c.value.i;
+		case SQLITE_FLOAT: return c.value.d;
+		case SQLITE_NULL: return fNullValue;
+		default: return strtod(mData.c_str() + c.value.offset, 0);
+	}
+}
+
+const char* SqlResultSet::getStringField(int nRow, int nField, const char* szNullValue) const {
+	const Cell& c = cell(nRow, nField);
+	if (c.type == SQLITE_NULL)
+		return szNullValue;
+	if (c.type == SQLITE_TEXT || c.type == SQLITE_BLOB)
+		return mData.c_str() + c.value.offset;
+	// Numbers are converted on demand, as sqlite3_column_text() would:
+	char szText[40];
+	if (c.type == SQLITE_INTEGER)
+		sqlite3_snprintf(sizeof(szText), szText, "%lld", (sqlite3_int64)c.value.i);
+	else
+		sqlite3_snprintf(sizeof(szText), szText, "%!.15g", c.value.d);
+	mConverted.assign(szText);
+	return mConverted.c_str();
+}
+
+const unsigned char* SqlResultSet::getBlobField(int nRow, int nField, int& nLen) const {
+	const Cell& c = cell(nRow, nField);
+	if (c.type != SQLITE_TEXT && c.type != SQLITE_BLOB) {
+		nLen = 0;
+		return 0;
+	}
+	nLen = c.len;
+	return (const unsigned char*)mData.c_str() + c.value.offset;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#ifdef SQLITE_ENABLE_SNAPSHOT
+
+SqlSnapshot::SqlSnapshot(const SqlSnapshot& rSnapshot) : mpSnapshot(rSnapshot.mpSnapshot) {
+	// The new object now owns the snapshot handle:
+	const_cast<SqlSnapshot&>(rSnapshot).mpSnapshot = 0;
+}
+
+SqlSnapshot& SqlSnapshot::operator=(const SqlSnapshot& rSnapshot) {
+	if (&rSnapshot != this) {
+		destroy();
+		mpSnapshot = rSnapshot.mpSnapshot;
+		const_cast<SqlSnapshot&>(rSnapshot).mpSnapshot = 0;
+	}
+	return *this;
+}
+
+void SqlSnapshot::destroy() {
+	if (mpSnapshot) {
+		sqlite3_snapshot_free(mpSnapshot);
+		mpSnapshot = 0;
+	}
+}
+
+int SqlSnapshot::compare(const SqlSnapshot& rOther) const {
+	require(mpSnapshot);
+	require(rOther.mpSnapshot);
+	return sqlite3_snapshot_cmp(mpSnapshot, rOther.mpSnapshot);
+}
+
+#endif
+////////////////////////////////////////////////////////////////////////////////
+
 SqlDatabase::SqlDatabase(const char* szFile, bool useExclusiveWAL /* = true */) {
 	mpDB = 0;
 	mnBusyTimeoutMs = 60000; // 60 seconds
+	mNextChangeHandlerId = 1;
+	mpStatementWarningHandler = 0;
+	mpStatementWarningArg = 0;
+	mnWarnFullScanSteps = mnWarnAutoIndexRows = 0;
+	mpPlanChangeHandler = 0;
+	mpPlanChangeArg = 0;
+	mnProgressInterval = 1000;
+	mProgressChecksEnabled = false;
+	mpLimitedStatement = 0;
+	mAbortReason = 0;
+	mpRegistry = 0;
+	mTrackOpenStatements = false;
+	mnOpenStatementPruneAt = 64;
+	mChangesBase = mReportedChanges = 0;
+	mCommitted = false;
 	assert(sqlite3_libversion_number()==SQLITE_VERSION_NUMBER);
 
 	if (sqlite3_open(szFile, &mpDB) != SQLITE_OK)
@@ -349,6 +1409,21 @@ SqlDatabase::SqlDatabase(const char* szFile, bool useExclusiveWAL /* = true */)
 SqlDatabase::SqlDatabase(const SqlDatabase& db) {
 	mpDB = db.mpDB;
 	mnBusyTimeoutMs = 60000; // 60 seconds
+	mNextChangeHandlerId = 1;
+	mpStatementWarningHandler = 0;
+	mpStatementWarningArg = 0;
+	mnWarnFullScanSteps = mnWarnAutoIndexRows = 0;
+	mpPlanChangeHandler = 0;
+	mpPlanChangeArg = 0;
+	mnProgressInterval = 1000;
+	mProgressChecksEnabled = false;
+	mpLimitedStatement = 0;
+	mAbortReason = 0;
+	mpRegistry = 0;
+	mTrackOpenStatements = false;
+	mnOpenStatementPruneAt = 64;
+	mChangesBase = mReportedChanges = 0;
+	mCommitted = false;
 }
 
 
@@ -368,6 +1443,7 @@ SqlDatabase& SqlDatabase::operator=(const SqlDatabase& db) {
 
 void SqlDatabase::close() {
 	if (mpDB) {
+		destroyRegisteredStatements();
 		// ensure that we have destroyed all compiled statements:
 		if (sqlite3_next_stmt(mpDB, 0) != 0)
 			throw SqlDatabaseException("Tried to close a database before deleting or calling destroy() on all statement objects.");
@@ -379,23 +1455,93 @@ void SqlDatabase::close() {
 }
 
 
-SqlStatement SqlDatabase::sqlCompile(const char* szSQL) {
+SqlStatement SqlDatabase::sqlCompile(const char* szSQL, unsigned int flags) {
 	require(mpDB);
 
 	const char* szTail=0;
 	sqlite3_stmt* pVM;
 
+#if SQLITE_VERSION_NUMBER >= 3020000
+	unsigned int prepareFlags = 0;
+	if (flags & PREPARE_PERSISTENT)
+		prepareFlags |= SQLITE_PREPARE_PERSISTENT;
+#ifdef SQLITE_PREPARE_NO_VTAB // Added in SQLite 3.28.0
+	if (flags & PREPARE_NO_VTAB)
+		prepareFlags |= SQLITE_PREPARE_NO_VTAB;
+#endif
+	const int result = sqlite3_prepare_v3(mpDB, szSQL, -1, prepareFlags, &pVM, &szTail);
+#else
+	(void)flags;
 	const int result = sqlite3_prepare_v2(mpDB, szSQL, -1, &pVM, &szTail);
+#endif
 	assert(szTail != 0);
 	const bool extra_statements = (szTail[0] != '\0'); // was (szTail && szTail[0] != '\0')
 	if (result != SQLITE_OK)
 		ThrowStatusCodeException(result, mpDB);
-	if (extra_statements)
+	if (extra_statements) {
+		sqlite3_finalize(pVM); // Otherwise it would stop the database from being closed
 		throw SqlDatabaseException("sqlCompile() only compiles the first statement; other statements have been ignored.");
-	return SqlStatement(pVM);
+	}
+	return SqlStatement(pVM, this);
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+
+int SqlStatementRegistry::declare(const char* szSQL, unsigned int flags) {
+	require(szSQL);
+	Declared statement;
+	statement.sql = szSQL;
+	statement.flags = flags;
+	mStatements.push_back(statement);
+	return (int)mStatements.size() - 1;
+}
+
+const std::string& SqlStatementRegistry::sql(int id) const {
+	if (id < 0 || id >= (int)mStatements.size())
+		throw SqlDatabaseException("Invalid registered statement id.");
+	return mStatements[id].sql;
+}
+
+unsigned int SqlStatementRegistry::flags(int id) const {
+	if (id < 0 || id >= (int)mStatements.size())
+		throw SqlDatabaseException("Invalid registered statement id.");
+	return mStatements[id].flags;
+}
+
+void SqlDatabase::useStatementRegistry(const SqlStatementRegistry& rRegistry, bool prepareNow) {
+	destroyRegisteredStatements();
+	mpRegistry = &rRegistry;
+	mRegisteredStatements.assign(rRegistry.size(), (SqlStatement*)0);
+	if (prepareNow) {
+		for (int id = 0; id < rRegistry.size(); id++)
+			compileRegisteredStatement(id);
+	}
+}
+
+SqlStatement& SqlDatabase::compileRegisteredStatement(int id) {
+	if (!mpRegistry)
+		throw SqlDatabaseException("statement() called without a statement registry; call useStatementRegistry() first.");
+	const std::string& sql = mpRegistry->sql(id); // Validates id
+	if ((size_t)id >= mRegisteredStatements.size())
+		mRegisteredStatements.resize(mpRegistry->size(), (SqlStatement*)0); // Declared after useStatementRegistry()
+	SqlStatement* pStatement = new SqlStatement();
+	try {
+		*pStatement = sqlCompile(sql, mpRegistry->flags(id));
+	} catch (...) {
+		delete pStatement;
+		throw;
+	}
+	mRegisteredStatements[id] = pStatement;
+	return *pStatement;
+}
+
+void SqlDatabase::destroyRegisteredStatements() {
+	for (size_t i = 0; i < mRegisteredStatements.size(); i++)
+		delete mRegisteredStatements[i];
+	mRegisteredStatements.clear();
+}
+
 bool SqlDatabase::tableExists(const char* szTable) {
 	char szSQL[128];
 	sprintf(szSQL,
@@ -422,6 +1568,7 @@ void SqlDatabase::sqlExecute(const char* szSQL) {
 	int result = sqlite3_exec(mpDB, szSQL, 0, 0, 0);
 	if (result != SQLITE_OK)
 		ThrowStatusCodeException(result, mpDB);
+	deliverChanges();
 }
 
 // Format SQL with given arguments, then execute it.
@@ -439,6 +1586,7 @@ void SqlDatabase::sqlExec(const char* szSQL, ...) {
 	sqlite3_free(szSqlFormatted);
 	if (result != SQLITE_OK)
 		ThrowStatusCodeException(result, mpDB);
+	deliverChanges();
 }
 // Same but accepts a va_list
 void SqlDatabase::sqlExecVar(const char* szSQL, va_list args) {
@@ -451,12 +1599,18 @@ void SqlDatabase::sqlExecVar(const char* szSQL, va_list args) {
 	sqlite3_free(szSqlFormatted);
 	if (result != SQLITE_OK)
 		ThrowStatusCodeException(result, mpDB);
+	deliverChanges();
 }
 
 int SqlDatabase::numberOfRowsChanged() const {
 	return sqlite3_changes(mpDB);
 }
 
+bool SqlDatabase::inTransaction() const {
+	require(mpDB);
+	return sqlite3_get_autocommit(mpDB) == 0;
+}
+
 
 SqlStatement SqlDatabase::sqlQuery(const char* szSQL, ...) {
 	va_list va;
@@ -480,10 +1634,12 @@ SqlStatement SqlDatabase::sqlQueryVar(const char* szSQL, va_list args) {
 	sqlite3_free(szSqlFormatted);
 	if (result != SQLITE_OK)
 		ThrowStatusCodeException(result, mpDB);
-	if (extra_statements)
+	if (extra_statements) {
+		sqlite3_finalize(pVM); // Otherwise it would stop the database from being closed
 		throw SqlDatabaseException("sqlQuery() only compiles the first statement; other statements have been ignored.");
+	}
 	
-	return SqlStatement(pVM).execute();
+	return SqlStatement(pVM, this).execute();
 }
 
 std::string SqlDatabase::sqlFormat(char formatType, const char* str) {
@@ -514,6 +1670,219 @@ void SqlDatabase::setBusyTimeout(int nMillisecs) {
 	sqlite3_busy_timeout(mpDB, mnBusyTimeoutMs);
 }
 
+bool SqlDatabase::walCheckpoint(SqlCheckpointMode mode, int* pnLogFrames, int* pnCheckpointedFrames) {
+	require(mpDB);
+	const int result = sqlite3_wal_checkpoint_v2(mpDB, 0, (int)mode, pnLogFrames, pnCheckpointedFrames);
+	if (result == SQLITE_BUSY || result == SQLITE_LOCKED)
+		return false;
+	if (result != SQLITE_OK)
+		ThrowStatusCodeException(result, mpDB);
+	return true;
+}
+
+void SqlDatabase::setWalAutoCheckpoint(int nFrames) {
+	require(mpDB);
+	sqlite3_wal_autocheckpoint(mpDB, nFrames);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// SQLite callbacks used to implement SqlDatabase::onChange()
+struct SqlDatabaseHooks {
+	static void onUpdate(void* pArg, int, const char*, const char* szTable, sqlite3_int64) {
+		SqlDatabase* pDatabase = static_cast<SqlDatabase*>(pArg);
+		// Most transactions touch a single table many times; avoid a set lookup for each row
+		pDatabase->mReportedChanges++;
+		std::set<std::string>& pending = pDatabase->mPendingChanges;
+		if (pending.size() == 1 && *pending.begin() == szTable)
+			return;
+		pending.insert(szTable);
+	}
+	static int onCommit(void* pArg) {
+		SqlDatabase* pDatabase = static_cast<SqlDatabase*>(pArg);
+		pDatabase->mCommittedChanges.insert(pDatabase->mPendingChanges.begin(), pDatabase->mPendingChanges.end());
+		pDatabase->mPendingChanges.clear();
+		pDatabase->mCommitted = true;
+		return 0; // Allow the commit to proceed
+	}
+	static void onRollback(void* pArg) {
+		SqlDatabase* pDatabase = static_cast<SqlDatabase*>(pArg);
+		pDatabase->mPendingChanges.clear();
+		// Forget the rolled back changes (those of a statement that failed in autocommit
+		// mode are never added to the total)
+		pDatabase->mChangesBase = sqlite3_total_changes(pDatabase->mpDB);
+		pDatabase->mReportedChanges = 0;
+	}
+	static int onProgress(void* pArg) {
+		SqlDatabase* pDatabase = static_cast<SqlDatabase*>(pArg);
+		if (!pDatabase->mpLimitedStatement)
+			return 0; // A statement without limits, or sqlExecute()
+		const int reason = pDatabase->mpLimitedStatement->limitExceeded();
+		if (!reason)
+			return 0;
+		pDatabase->mAbortReason = reason;
+		return 1; // Make sqlite3_step() return SQLITE_INTERRUPT
+	}
+};
+
+void SqlDatabase::setOpenStatementTracking(bool enable) {
+	mTrackOpenStatements = enable;
+	if (!enable)
+		mOpenStatementTimes.clear();
+}
+
+void SqlDatabase::recordOpenStatement(sqlite3_stmt* pVM) {
+	mOpenStatementTimes[pVM] = MonotonicMs();
+	if (mOpenStatementTimes.size() >= mnOpenStatementPruneAt) {
+		pruneOpenStatementTimes();
+		mnOpenStatementPruneAt = std::max<size_t>(64, mOpenStatementTimes.size() * 2);
+	}
+}
+
+void SqlDatabase::pruneOpenStatementTimes() const {
+	// Entries are not removed when a statement finishes or is finalized (the statement may
+	// outlive this database), so keep only those that are still busy. A finalized handle
+	// may be reused by a new statement, but that then records its own time when it runs.
+	std::map<sqlite3_stmt*, int64_t> stillOpen;
+	for (sqlite3_stmt* pVM = sqlite3_next_stmt(mpDB, 0); pVM; pVM = sqlite3_next_stmt(mpDB, pVM)) {
+		if (!sqlite3_stmt_busy(pVM))
+			continue;
+		std::map<sqlite3_stmt*, int64_t>::const_iterator it = mOpenStatementTimes.find(pVM);
+		if (it != mOpenStatementTimes.end())
+			stillOpen.insert(*it);
+	}
+	mOpenStatementTimes.swap(stillOpen);
+}
+
+std::vector<SqlOpenStatement> SqlDatabase::openStatements(int minAgeMs) const {
+	require(mpDB);
+	pruneOpenStatementTimes();
+	const int64_t now = MonotonicMs();
+	std::vector<SqlOpenStatement> result;
+	for (sqlite3_stmt* pVM = sqlite3_next_stmt(mpDB, 0); pVM; pVM = sqlite3_next_stmt(mpDB, pVM)) {
+		if (!sqlite3_stmt_busy(pVM))
+			continue;
+		SqlOpenStatement info;
+		info.sql = sqlite3_sql(pVM);
+		std::map<sqlite3_stmt*, int64_t>::const_iterator it = mOpenStatementTimes.find(pVM);
+		info.openMs = (it != mOpenStatementTimes.end()) ? now - it->second : -1;
+		if (info.openMs < 0 || info.openMs >= minAgeMs)
+			result.push_back(info);
+	}
+	return result;
+}
+
+void SqlDatabase::setProgressCheckInterval(int nInstructions) {
+	mnProgressInterval = nInstructions > 0 ? nInstructions : 1;
+	if (mProgressChecksEnabled) {
+		mProgressChecksEnabled = false;
+		enableProgressChecks();
+	}
+}
+
+void SqlDatabase::enableProgressChecks() {
+	if (mProgressChecksEnabled)
+		return;
+	require(mpDB);
+	sqlite3_progress_handler(mpDB, mnProgressInterval, &SqlDatabaseHooks::onProgress, this);
+	mProgressChecksEnabled = true;
+}
+
+int SqlDatabase::onChange(const char* szTable, void(*pHandler)(void*,const char*), void* customArg) {
+	require(mpDB);
+	require(pHandler);
+	if (mChangeHandlers.empty()) {
+		sqlite3_update_hook(mpDB, &SqlDatabaseHooks::onUpdate, this);
+		sqlite3_commit_hook(mpDB, &SqlDatabaseHooks::onCommit, this);
+		sqlite3_rollback_hook(mpDB, &SqlDatabaseHooks::onRollback, this);
+		mChangesBase = sqlite3_total_changes(mpDB);
+		mReportedChanges = 0;
+	}
+	ChangeHandler handler;
+	handler.id = mNextChangeHandlerId++;
+	handler.table = szTable ? szTable : "";
+	handler.pHandler = pHandler;
+	handler.pArg = customArg;
+	mChangeHandlers.push_back(handler);
+	return handler.id;
+}
+
+void SqlDatabase::removeChangeHandler(int handlerId) {
+	for (size_t i = 0; i < mChangeHandlers.size(); i++) {
+		if (mChangeHandlers[i].id == handlerId) {
+			mChangeHandlers.erase(mChangeHandlers.begin() + i);
+			break;
+		}
+	}
+	if (mChangeHandlers.empty() && mpDB) {
+		sqlite3_update_hook(mpDB, 0, 0);
+		sqlite3_commit_hook(mpDB, 0, 0);
+		sqlite3_rollback_hook(mpDB, 0, 0);
+		sqlite3_mutex_enter(sqlite3_db_mutex(mpDB));
+		mPendingChanges.clear();
+		mCommittedChanges.clear();
+		mCommitted = false;
+		sqlite3_mutex_leave(sqlite3_db_mutex(mpDB));
+	}
+}
+
+void SqlDatabase::deliverChangeNotifications() {
+	// Handlers may run SQL that commits more changes, or add/remove handlers, so work on copies.
+	// The hooks run on whichever thread steps the connection, holding its mutex (which is
+	// NULL, and the calls no-ops, unless SQLite is in serialized mode).
+	std::set<std::string> tables;
+	bool unreported = false;
+	sqlite3_mutex* pMutex = sqlite3_db_mutex(mpDB);
+	sqlite3_mutex_enter(pMutex);
+	// If the COMMIT did not complete (e.g. SQLITE_BUSY), it may yet be retried
+	if (sqlite3_get_autocommit(mpDB)) {
+		tables.swap(mCommittedChanges);
+		if (mCommitted) {
+			// Compare the rows changed with those the update hook reported, to catch changes
+			// to WITHOUT ROWID tables and the truncate optimization for "DELETE FROM t".
+			// This is done here rather than in the commit hook, since SQLite only adds an
+			// autocommit statement's changes to the total after it has committed.
+			const int totalChanges = sqlite3_total_changes(mpDB);
+			unreported = (totalChanges - mChangesBase > mReportedChanges);
+			mChangesBase = totalChanges;
+			mReportedChanges = 0;
+			mCommitted = false;
+		}
+	}
+	sqlite3_mutex_leave(pMutex);
+	if (tables.empty() && !unreported)
+		return;
+	const std::vector<ChangeHandler> handlers(mChangeHandlers);
+	for (std::set<std::string>::const_iterator it = tables.begin(); it != tables.end(); ++it) {
+		for (size_t i = 0; i < handlers.size(); i++) {
+			if (handlers[i].table.empty() || handlers[i].table == *it)
+				handlers[i].pHandler(handlers[i].pArg, it->c_str());
+		}
+	}
+	if (unreported) {
+		for (size_t i = 0; i < handlers.size(); i++)
+			handlers[i].pHandler(handlers[i].pArg, 0);
+	}
+}
+
+void SqlDatabase::setStatementWarningHandler(void(*pHandler)(void*,const char*,const SqlStatementStats&),
+	void* customArg, int nFullScanSteps, int nAutoIndexRows)
+{
+	mpStatementWarningHandler = pHandler;
+	mpStatementWarningArg = customArg;
+	mnWarnFullScanSteps = nFullScanSteps;
+	mnWarnAutoIndexRows = nAutoIndexRows;
+}
+
+void SqlDatabase::setPlanChangeHandler(void(*pHandler)(void*,const char*,const SqlQueryPlan&,const SqlQueryPlan&),
+	void* customArg)
+{
+	mpPlanChangeHandler = pHandler;
+	mpPlanChangeArg = customArg;
+	if (!pHandler)
+		mKnownPlans.clear();
+}
+
 void SqlDatabase::interrupt() { sqlite3_interrupt(mpDB); }
 
 const char* SqlDatabase::SQLiteVersion() { return SQLITE_VERSION; }
@@ -521,3 +1890,37 @@ const char* SqlDatabase::SQLiteVersion() { return SQLITE_VERSION; }
 void SqlDatabase::setSqlTraceHandler(void(*pHandler)(void*,const char*), void* customArg) {
 	sqlite3_trace(mpDB, pHandler, customArg);
 }
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+SqlSnapshot SqlDatabase::takeSnapshot() {
+	require(mpDB);
+	if (sqlite3_get_autocommit(mpDB)) {
+		// sqlite3_snapshot_get() requires an open read transaction; reading the schema starts one.
+		sqlExecute("BEGIN; SELECT COUNT(*) FROM sqlite_master;");
+	}
+	sqlite3_snapshot* pSnapshot = 0;
+	const int result = sqlite3_snapshot_get(mpDB, "main", &pSnapshot);
+	if (result != SQLITE_OK)
+		ThrowStatusCodeException(result, mpDB);
+	return SqlSnapshot(pSnapshot);
+}
+
+void SqlDatabase::beginSnapshotRead(const SqlSnapshot& rSnapshot) {
+	require(mpDB);
+	require(rSnapshot.mpSnapshot);
+	if (!sqlite3_get_autocommit(mpDB))
+		throw SqlDatabaseException("beginSnapshotRead() cannot be called inside a transaction.");
+	sqlExecute("BEGIN");
+	const int result = sqlite3_snapshot_open(mpDB, "main", rSnapshot.mpSnapshot);
+	if (result != SQLITE_OK) {
+		sqlite3_exec(mpDB, "ROLLBACK", 0, 0, 0);
+		ThrowStatusCodeException(result, mpDB);
+	}
+}
+
+void SqlDatabase::endRead() {
+	require(mpDB);
+	if (!sqlite3_get_autocommit(mpDB))
+		sqlExecute("COMMIT");
+}
+#endif
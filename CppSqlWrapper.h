@@ -33,12 +33,39 @@
 #include <stdarg.h>     // Needed for the definition of va_list
 #include <string>
 #include <stdexcept>
+#include <iosfwd>
+#include <iterator>
+#include <cstddef>
+#include <map>
+#include <set>
+#include <vector>
+
+// The C++ standard being compiled against (MSVC only sets __cplusplus correctly with /Zc:__cplusplus)
+#if defined(_MSVC_LANG) && _MSVC_LANG > __cplusplus
+#define CPP_SQL_WRAPPER_CPLUSPLUS _MSVC_LANG
+#else
+#define CPP_SQL_WRAPPER_CPLUSPLUS __cplusplus
+#endif
+#if CPP_SQL_WRAPPER_CPLUSPLUS >= 201103L
+#include <type_traits>
+#endif
+#if CPP_SQL_WRAPPER_CPLUSPLUS >= 201703L
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#endif
+#if CPP_SQL_WRAPPER_CPLUSPLUS >= 202002L
+#include <span>
+#endif
 
-// Forward declaration:
+// Forward declarations:
 class SqlDatabase;
+class SqlExportWriter;
 // Declare SQLite internal structures:
 struct sqlite3;
 struct sqlite3_stmt;
+struct sqlite3_snapshot;
 
 // Declare the SQLite3 datatypes so that "sqlite3.h" does not need to be included
 #ifndef SQLITE_INTEGER
@@ -53,6 +80,20 @@ enum SqlType {
 typedef int SqlType;
 #endif
 
+// Checkpoint modes for SqlDatabase::walCheckpoint(); see http://www.sqlite.org/c3ref/wal_checkpoint_v2.html
+enum SqlCheckpointMode {
+	CHECKPOINT_PASSIVE=0,  // Checkpoint as many frames as possible without waiting for readers or writers
+	CHECKPOINT_FULL=1,     // Wait for writers, then checkpoint everything
+	CHECKPOINT_RESTART=2,  // Like FULL, then also wait for readers so the next writer restarts the WAL
+	CHECKPOINT_TRUNCATE=3, // Like RESTART, then also truncate the WAL file to zero bytes
+};
+
+// Flags for SqlDatabase::sqlCompile(); see http://www.sqlite.org/c3ref/c_prepare_normalize.html
+enum SqlPrepareFlags {
+	PREPARE_PERSISTENT=0x01, // The statement will be kept and reused for a long time (e.g. in a cache)
+	PREPARE_NO_VTAB=0x04,    // Fail to compile if the statement uses a virtual table
+};
+
 class SqlDatabaseException : public std::runtime_error {
 public:
 	SqlDatabaseException(const std::string& reason) : std::runtime_error(std::string("Database error: ").append(reason)) { }
@@ -61,12 +102,159 @@ class SqlDatabaseBusyException : public SqlDatabaseException {
 public:
 	SqlDatabaseBusyException() : SqlDatabaseException("Database error: Database busy.") { }
 };
+// Thrown when a statement runs past the timeout set with SqlStatement::setTimeout()
+class SqlDatabaseTimeoutException : public SqlDatabaseException {
+public:
+	SqlDatabaseTimeoutException(bool rolledBack = false)
+		: SqlDatabaseException(rolledBack ? "Query timed out; the transaction was rolled back." : "Query timed out."), mRolledBack(rolledBack) { }
+	// True if SQLite rolled back the explicit transaction the statement was running in
+	bool transactionRolledBack() const { return mRolledBack; }
+private:
+	bool mRolledBack;
+};
+// Thrown when a statement's cancellation token is cancelled while it is running
+class SqlDatabaseCancelledException : public SqlDatabaseException {
+public:
+	SqlDatabaseCancelledException(bool rolledBack = false)
+		: SqlDatabaseException(rolledBack ? "Query cancelled; the transaction was rolled back." : "Query cancelled."), mRolledBack(rolledBack) { }
+	// True if SQLite rolled back the explicit transaction the statement was running in
+	bool transactionRolledBack() const { return mRolledBack; }
+private:
+	bool mRolledBack;
+};
+
+// A flag that aborts any statement using it (see SqlStatement::setCancellationToken()).
+// cancel() may be called from any thread.
+class SqlCancellationToken {
+public:
+	SqlCancellationToken() : mCancelled(0) {}
+	void cancel();
+	void reset();
+	bool isCancelled() const;
+private:
+	SqlCancellationToken(const SqlCancellationToken&);
+	SqlCancellationToken& operator=(const SqlCancellationToken&);
+	// The same at every language level, as C++98 and C++11 code may share a token; the
+	// functions above access it atomically
+	volatile int mCancelled;
+};
+
+// Performance counters for a SqlStatement; see http://www.sqlite.org/c3ref/c_stmtstatus_counter.html
+struct SqlStatementStats {
+	int fullScanSteps; // Steps forward through a table as part of a full table scan
+	int sorts;         // Sort operations (a sort that could not use an index)
+	int autoIndexRows; // Rows inserted into automatically created transient indexes
+	int vmSteps;       // Virtual machine instructions run
+	int reprepares;    // Times the statement was re-prepared after a schema change
+	int runs;          // Times the statement has been run to completion or reset
+	int memoryUsed;    // Bytes of heap used by the compiled statement
+};
+
+// What SqlStatement::run() did
+struct SqlWriteResult {
+	int changes;       // Rows inserted, updated or deleted (see SqlDatabase::numberOfRowsChanged())
+	int64_t lastRowId; // The connection's most recent INSERT rowid (see SqlDatabase::lastRowId())
+};
+
+// A statement that is part-way through its result rows, and so is holding a read
+// transaction open; see SqlDatabase::openStatements()
+struct SqlOpenStatement {
+	std::string sql;
+	int64_t openMs; // How long since execute() returned its first row, or -1 if not tracked
+};
+
+// One step of a query plan, as reported by EXPLAIN QUERY PLAN, e.g. "SEARCH users USING INDEX ..."
+struct SqlQueryPlanNode {
+	int id;
+	int parentId;
+	std::string detail;
+	std::vector<SqlQueryPlanNode> children;
+};
+
+// The parsed output of EXPLAIN QUERY PLAN for a statement
+class SqlQueryPlan {
+	friend class SqlStatement;
+public:
+	const std::vector<SqlQueryPlanNode>& roots() const { return mRoots; }
+	bool empty() const { return mRoots.empty(); }
+	// The plan as indented text, one node per line
+	std::string toString() const;
+	// Number of steps that scan a whole table or index ("SCAN ...") rather than searching it
+	int numFullScans() const;
+
+	bool operator==(const SqlQueryPlan& rOther) const { return toString() == rOther.toString(); }
+	bool operator!=(const SqlQueryPlan& rOther) const { return !(*this == rOther); }
+private:
+	std::vector<SqlQueryPlanNode> mRoots;
+};
+
+// A single SQL value of any type, owning its own copy of any text or blob data.
+class SqlValue {
+public:
+	SqlValue() : mType(SQLITE_NULL), mInt(0), mFloat(0.0) {}
+	SqlValue(int nValue) : mType(SQLITE_INTEGER), mInt(nValue), mFloat(0.0) {}
+	SqlValue(int64_t nValue) : mType(SQLITE_INTEGER), mInt(nValue), mFloat(0.0) {}
+	SqlValue(double dValue) : mType(SQLITE_FLOAT), mInt(0), mFloat(dValue) {}
+	SqlValue(const char* szValue) : mType(szValue ? SQLITE_TEXT : SQLITE_NULL), mInt(0), mFloat(0.0), mText(szValue ? szValue : "") {}
+	SqlValue(const std::string& szValue) : mType(SQLITE_TEXT), mInt(0), mFloat(0.0), mText(szValue) {}
+	static SqlValue blob(const unsigned char* blobValue, int nLen);
+
+	SqlType type() const { return mType; }
+	bool isNull() const { return mType == SQLITE_NULL; }
+	int64_t asInt64() const { return mType == SQLITE_FLOAT ? (int64_t)mFloat : mInt; }
+	double asFloat() const { return mType == SQLITE_FLOAT ? mFloat : (double)mInt; }
+	// The text, or the bytes of a blob:
+	const std::string& asString() const { return mText; }
+private:
+	SqlType mType;
+	int64_t mInt;
+	double mFloat;
+	std::string mText;
+};
+
+// Information about one result column of a compiled statement
+struct SqlColumnInfo {
+	const char* name;
+	const char* declType;     // Declared type of the source table column, or NULL for an expression
+	// The database, table and column the value comes from, or NULL for an expression.
+	// Only available if SQLite and this file are compiled with SQLITE_ENABLE_COLUMN_METADATA.
+	const char* databaseName;
+	const char* tableName;
+	const char* originName;
+};
+
+// The result columns of a compiled statement, gathered once (on first use) and then shared
+// by every execution of the statement. All strings are owned by this object and live in a
+// single buffer.
+class SqlColumnMetadata {
+	friend class SqlStatement;
+public:
+	int numColumns() const { return (int)mColumns.size(); }
+	const SqlColumnInfo& column(int nColumn) const;
+	// Returns the index of the first column with the given name, or -1 if there is none
+	int indexOf(const char* szName) const;
+private:
+	explicit SqlColumnMetadata(sqlite3_stmt* pVM);
+	// Not copyable: the names in mColumns point into mStrings
+	SqlColumnMetadata(const SqlColumnMetadata&);
+	SqlColumnMetadata& operator=(const SqlColumnMetadata&);
+	std::vector<SqlColumnInfo> mColumns;
+	std::string mStrings;
+	int mReprepares; // The statement's re-prepare count when this was gathered
+};
+
+#if CPP_SQL_WRAPPER_CPLUSPLUS >= 201703L
+// Reads one column of the current row as a T, for SqlStatement::as<>(); specialized below
+template<typename T> struct SqlColumnReader;
+#endif
 
 class SqlStatement {
 	friend class ResultRow;
+	friend class SqlResultSet;
+	friend struct SqlDatabaseHooks;
 public:
 	SqlStatement();
-	SqlStatement(sqlite3_stmt* pVM);
+	SqlStatement(sqlite3_stmt* pVM, SqlDatabase* pDatabase = 0);
 	SqlStatement(const SqlStatement& rStatement);
 	~SqlStatement() { destroy(); }
 	SqlStatement& operator=(const SqlStatement& rStatement);
@@ -81,6 +269,62 @@ public:
     SqlStatement &bind(const unsigned char* blobValue, int nLen);
     SqlStatement &bindNull();
 	SqlStatement &bindSame(); // leave a bound parameter unchanged
+	SqlStatement &bind(const SqlValue& value);
+
+	// A parameter of this statement, resolved once by name with param(), so that it can
+	// be bound repeatedly as cheaply as by position. Only use it with the statement that
+	// created it.
+	class ParamRef {
+		friend class SqlStatement;
+	public:
+		ParamRef() : mIndex(0) {}
+		int index() const { return mIndex; } // One-based, as in SQLite
+	private:
+		explicit ParamRef(int index) : mIndex(index) {}
+		int mIndex;
+	};
+	// The number of parameters in the statement (the largest index, if they are numbered)
+	int numParams() const;
+	// Look up a named parameter, including its prefix, e.g. ":name", "@name" or "$name".
+	// The names are read from SQLite once per statement, on first use.
+	ParamRef param(const char* szName) const;
+
+	// Bind a value to one parameter. Unlike the positional methods above, this does not
+	// affect any other parameter: values stay bound (even across execute()) until replaced.
+	SqlStatement &bind(ParamRef param, const char* szValue);
+	SqlStatement &bind(ParamRef param, const int nValue);
+	SqlStatement &bind(ParamRef param, const int64_t nValue);
+	SqlStatement &bind(ParamRef param, const double dValue);
+	SqlStatement &bind(ParamRef param, const unsigned char* blobValue, int nLen);
+	SqlStatement &bind(ParamRef param, const SqlValue& value);
+	SqlStatement &bindNull(ParamRef param);
+	// The same, by name: statement.bindNamed(":id", 42). (Not overloads of bind(), where
+	// e.g. bind("a", "b") would silently change meaning from two positional values.)
+	SqlStatement &bindNamed(const char* szName, const char* szValue) { return bind(param(szName), szValue); }
+	SqlStatement &bindNamed(const char* szName, const int nValue) { return bind(param(szName), nValue); }
+	SqlStatement &bindNamed(const char* szName, const int64_t nValue) { return bind(param(szName), nValue); }
+	SqlStatement &bindNamed(const char* szName, const double dValue) { return bind(param(szName), dValue); }
+	SqlStatement &bindNamed(const char* szName, const unsigned char* blobValue, int nLen) { return bind(param(szName), blobValue, nLen); }
+	SqlStatement &bindNamed(const char* szName, const SqlValue& value) { return bind(param(szName), value); }
+	SqlStatement &bindNullNamed(const char* szName) { return bindNull(param(szName)); }
+
+#if CPP_SQL_WRAPPER_CPLUSPLUS >= 201103L
+	// Bind every parameter of the statement at once, replacing any previous values:
+	//     statement.bindAll(id, "name", 2.5, nullptr).execute();
+	// The number of values must match the number of parameters. Besides the types bind()
+	// takes, this accepts bool, any integer type, float, std::string, nullptr and (from
+	// C++17) std::string_view and std::optional<T>, where an empty optional binds NULL.
+	template<typename... Values>
+	SqlStatement& bindAll(const Values&... values) {
+		beginBindAll((int)sizeof...(Values));
+		int index = 0, result = 0;
+		// A braced list is evaluated left to right, so this binds the values in order
+		const int unused[] = {0, (result |= bindAt(++index, values))...};
+		(void)unused;
+		endBindAll(result);
+		return *this;
+	}
+#endif
 	
 	/////////// The two methods to run the SQL 
 	// After binding all parameters, call execute() or query()
@@ -90,6 +334,11 @@ public:
 	// by binding new parameters and calling execute() again
 	// Returns a self-reference
 	SqlStatement &execute();
+	// Run a statement that returns no rows (INSERT, UPDATE, DELETE, ...) and reset it
+	// straight away, so that its locks are released immediately. Skips the result row
+	// bookkeeping of execute(); any rows the statement would return are discarded.
+	// Parameters are bound in the same way as for execute().
+	SqlWriteResult run();
 	// TODO: getSingleRow() method which returns one row or causes error.
 
 	class ResultRow { // This class only exists to make the syntax a bit cleaner
@@ -123,11 +372,44 @@ public:
 
 		bool fieldIsNull(int nField) const { return (fieldDataType(nField) == SQLITE_NULL); }
 		bool fieldIsNull(const char* szField) const { return fieldIsNull(fieldIndex(szField)); }
+
+#if CPP_SQL_WRAPPER_CPLUSPLUS >= 201703L
+		// Zero-copy, length-aware access to text (C++17). The view is only valid until the
+		// next call to nextRow() or execute(), or until the statement is reset or destroyed.
+		// NULL gives an empty view.
+		std::string_view getStringView(int nField) const;
+		std::string_view getStringView(const char* szField) const { return getStringView(fieldIndex(szField)); }
+#endif
+#if defined(__cpp_lib_span)
+		// Zero-copy access to blob data (C++20), valid for the same time as getStringView()
+		std::span<const unsigned char> getBlobSpan(int nField) const;
+		std::span<const unsigned char> getBlobSpan(const char* szField) const { return getBlobSpan(fieldIndex(szField)); }
+#endif
+
+		// Unchecked accessors, for hot loops where the caller has already made sure there is a
+		// current row with at least nField+1 columns (e.g. by checking numFields() once).
+		// Nothing is validated, so a bad index is undefined behaviour. Each is a single
+		// sqlite3_column_*() call; NULL reads as 0, 0.0, or a NULL pointer, unless a value to
+		// use for NULL is given (which costs an extra sqlite3_column_type() call for numbers).
+		int getIntUnchecked(int nField) const;
+		int getIntUnchecked(int nField, int nNullValue) const;
+		int64_t getInt64Unchecked(int nField) const;
+		int64_t getInt64Unchecked(int nField, int64_t nNullValue) const;
+		double getFloatUnchecked(int nField) const;
+		double getFloatUnchecked(int nField, double fNullValue) const;
+		const char* getStringUnchecked(int nField) const;
+		const char* getStringUnchecked(int nField, const char* szNullValue) const;
+		SqlType fieldDataTypeUnchecked(int nField) const;
+#if CPP_SQL_WRAPPER_CPLUSPLUS >= 201703L
+		std::string_view getStringViewUnchecked(int nField) const;
+#endif
+
+		// A copy refers to the same statement, and so always shows its current row
+		ResultRow(const ResultRow& rResultRow) : mpParent(rResultRow.mpParent) {}
 	private:
 		inline void checkIndex(int nField) const;
 		const SqlStatement* mpParent;
 
-		ResultRow(const ResultRow& rResultRow) : mpParent(rResultRow.mpParent) {}
 		ResultRow& operator=(const ResultRow& rResultRow) {
 			mpParent = rResultRow.mpParent;	return *this;
 		}
@@ -141,6 +423,137 @@ public:
 	bool hasRow() const { return !mEndOfRows; }
 	bool nextRow(); // Advance current row forward; returns false if we were at the last row
 
+	// Iterates over the rows of a statement, stepping once per increment:
+	//     for (auto row : statement.rows()) ... row.getStringField(0) ...
+	// As with currentRow(), each row is only valid until the iterator moves on.
+	class RowIterator {
+	public:
+		typedef std::input_iterator_tag iterator_category;
+		typedef ResultRow value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const ResultRow* pointer;
+		typedef const ResultRow& reference;
+
+		RowIterator() : mpStatement(0) {} // The end
+		explicit RowIterator(SqlStatement* pStatement) : mpStatement(pStatement) {}
+		const ResultRow& operator*() const { return mpStatement->mResult; }
+		const ResultRow* operator->() const { return &mpStatement->mResult; }
+		RowIterator& operator++() { mpStatement->advance(); return *this; }
+		void operator++(int) { mpStatement->advance(); }
+		bool operator==(const RowIterator& rOther) const { return atEnd() == rOther.atEnd(); }
+		bool operator!=(const RowIterator& rOther) const { return atEnd() != rOther.atEnd(); }
+	protected:
+		bool atEnd() const { return !mpStatement || mpStatement->mEndOfRows; }
+		SqlStatement* mpStatement;
+	};
+	class RowRange {
+	public:
+		explicit RowRange(SqlStatement* pStatement) : mpStatement(pStatement) {}
+		RowIterator begin() const { return RowIterator(mpStatement); }
+		RowIterator end() const { return RowIterator(); }
+	private:
+		SqlStatement* mpStatement;
+	};
+	// Run the statement (as execute() does) and return a range over its result rows
+	RowRange rows() { execute(); return RowRange(this); }
+
+#if CPP_SQL_WRAPPER_CPLUSPLUS >= 201703L
+	// Like rows(), but each row is a std::tuple of the first sizeof...(Ts) columns:
+	//     for (auto [id, name] : statement.as<int64_t, std::string_view>()) ...
+	// Supported types are int, int64_t, double, bool, std::string, std::string_view (valid
+	// until the next row), const char* and std::optional of any of these, which is empty for
+	// NULL. Otherwise NULL reads as 0, an empty string or a NULL pointer. The number of
+	// columns is checked once, when the statement is run.
+	template<typename... Ts>
+	class TypedRowIterator : public RowIterator {
+	public:
+		typedef std::tuple<Ts...> value_type;
+		typedef std::tuple<Ts...> reference;
+		typedef void pointer;
+
+		TypedRowIterator() {}
+		explicit TypedRowIterator(SqlStatement* pStatement) : RowIterator(pStatement) {}
+		std::tuple<Ts...> operator*() const { return read(std::index_sequence_for<Ts...>()); }
+		TypedRowIterator& operator++() { mpStatement->advance(); return *this; }
+		void operator++(int) { mpStatement->advance(); }
+	private:
+		template<size_t... I>
+		std::tuple<Ts...> read(std::index_sequence<I...>) const {
+			return std::tuple<Ts...>(SqlColumnReader<Ts>::read(mpStatement->mResult, (int)I)...);
+		}
+	};
+	template<typename... Ts>
+	class TypedRowRange {
+	public:
+		explicit TypedRowRange(SqlStatement* pStatement) : mpStatement(pStatement) {}
+		TypedRowIterator<Ts...> begin() const { return TypedRowIterator<Ts...>(mpStatement); }
+		TypedRowIterator<Ts...> end() const { return TypedRowIterator<Ts...>(); }
+	private:
+		SqlStatement* mpStatement;
+	};
+	template<typename... Ts>
+	TypedRowRange<Ts...> as() {
+		execute();
+		checkColumnCount((int)sizeof...(Ts));
+		return TypedRowRange<Ts...>(this);
+	}
+#endif
+
+	// True if this statement makes no direct changes to the database
+	bool isReadOnly() const;
+	// Names, declared types and origins of the result columns. These are gathered from SQLite
+	// the first time they are needed and cached for the life of the statement, so this is
+	// cheap to call repeatedly. Valid until the statement is destroyed.
+	// The column count is likewise cached when the statement is compiled. If SQLite
+	// re-prepares a statement that changes shape (e.g. "SELECT *" after ALTER TABLE), the
+	// new columns are picked up by the next call to columns().
+	const SqlColumnMetadata& columns() const;
+	// Get the performance counters for this statement, which accumulate over all runs.
+	// If resetCounters is true, they are then set back to zero (except memoryUsed).
+	SqlStatementStats stats(bool resetCounters = false) const;
+	// Get the plan SQLite has chosen for this statement (using EXPLAIN QUERY PLAN)
+	SqlQueryPlan queryPlan() const;
+
+	/////////// Limits
+	// These only affect this statement, so other work on the same connection carries on.
+	// They are checked before each step and, while SQLite is working, every few VM
+	// instructions (see SqlDatabase::setProgressCheckInterval()). Only for statements
+	// compiled by SqlDatabase::sqlCompile().
+
+	// Abort each run of this statement that takes longer than nMillisecs (0 = no limit),
+	// counting from execute() to the last nextRow(), with a SqlDatabaseTimeoutException.
+	// Takes effect at the next execute(). Time spent waiting for a lock is not cut short:
+	// that is bounded by the busy timeout (SqlDatabase::setBusyTimeout()), and the
+	// statement is aborted when it next runs after the wait.
+	// An abort interrupts SQLite (SQLITE_INTERRUPT), which may roll back the whole
+	// explicit transaction the statement is running in, not just the statement; the
+	// exception's transactionRolledBack() then returns true.
+	void setTimeout(int nMillisecs);
+	// Abort with a SqlDatabaseCancelledException once pToken is cancelled (NULL = none).
+	// As with a timeout, this may roll back the transaction. The token must outlive the
+	// statement or be replaced.
+	void setCancellationToken(const SqlCancellationToken* pToken) { mpCancellationToken = pToken; }
+
+	/////////// Exporting results
+	// Write the current row and all following rows to a stream or file descriptor, straight
+	// from SQLite's buffers through a fixed-size output buffer. Call after execute().
+	// Returns the number of rows written. BLOBs are written as hexadecimal strings.
+
+	// RFC 4180 CSV; the first line holds the column names if includeHeader is true.
+	int64_t exportCsv(std::ostream& out, bool includeHeader = true);
+	int64_t exportCsv(int fd, bool includeHeader = true);
+	// One JSON object per line, keyed by column name. NULL and non-finite floats become null.
+	int64_t exportJsonLines(std::ostream& out);
+	int64_t exportJsonLines(int fd);
+
+	// Stop reading rows now rather than at the next bind() or execute(). Until then, a
+	// statement that stopped part-way through its rows keeps its read transaction open,
+	// which in WAL mode stops checkpoints from getting past its snapshot. The bound
+	// parameters are kept, so execute() can run the statement again.
+	void reset();
+	// Like reset(), and also set all parameters back to NULL (freeing any bound text/blobs)
+	void finish();
+
 	// Free all resources associated with this sql statement:
 	// In general, resources will automatically be freed by this statement's destructor as
 	// it goes out of scope. Use this method only if you are being very conscious of memory
@@ -148,11 +561,229 @@ public:
 	void destroy();
 private:
 	inline void onBind();
+	void advance(); // nextRow() without the checks, for the row iterators
+	void checkColumnCount(int nColumns) const;
+	void refreshColumns() const;
+	inline void onNamedBind();
+	void beginBindAll(int nValues);
+	void endBindAll(int result);
+	// Bind without any checks, returning the SQLite result code (for bindAll())
+	int bindInt64At(int index, int64_t nValue);
+	int bindDoubleAt(int index, double dValue);
+	int bindTextAt(int index, const char* szValue, int nLen);
+	int bindNullAt(int index);
+	int bindAt(int index, const SqlValue& value);
+#if CPP_SQL_WRAPPER_CPLUSPLUS >= 201103L
+	// Each template only takes exactly the types it names, so that e.g. an enum or a
+	// pointer is not silently converted to bool
+	template<typename T>
+	typename std::enable_if<std::is_same<T, bool>::value, int>::type bindAt(int index, T bValue) {
+		return bindInt64At(index, bValue ? 1 : 0);
+	}
+	template<typename T>
+	typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, int>::type bindAt(int index, T nValue) {
+		if (std::is_unsigned<T>::value && sizeof(T) >= sizeof(int64_t) && (uint64_t)nValue > ((uint64_t)-1 >> 1))
+			throw SqlDatabaseException("Unsigned value is too large for an SQLite integer.");
+		return bindInt64At(index, (int64_t)nValue);
+	}
+	template<typename T>
+	typename std::enable_if<std::is_floating_point<T>::value, int>::type bindAt(int index, T dValue) {
+		return bindDoubleAt(index, (double)dValue);
+	}
+	template<typename T>
+	typename std::enable_if<std::is_enum<T>::value, int>::type bindAt(int index, T eValue) {
+		return bindAt(index, (typename std::underlying_type<T>::type)eValue); // As bind(eValue) would
+	}
+	int bindAt(int index, const char* szValue) { return szValue ? bindTextAt(index, szValue, -1) : bindNullAt(index); }
+	template<typename T>
+	int bindAt(int index, T* pValue) {
+		static_assert(std::is_same<typename std::remove_cv<T>::type, char>::value, "bindAll() can only bind a pointer to a C string.");
+		return bindAt(index, (const char*)pValue);
+	}
+	int bindAt(int index, const std::string& szValue) { return bindTextAt(index, szValue.data(), (int)szValue.size()); }
+	int bindAt(int index, std::nullptr_t) { return bindNullAt(index); }
+	template<typename T>
+	typename std::enable_if<std::is_class<T>::value, int>::type bindAt(int, const T&) {
+		static_assert(sizeof(T) == 0, "bindAll() cannot bind this type; convert it to a supported one (or SqlValue) first.");
+		return 0;
+	}
+#endif
+#if CPP_SQL_WRAPPER_CPLUSPLUS >= 201703L
+	int bindAt(int index, std::string_view szValue) { return bindTextAt(index, szValue.data(), (int)szValue.size()); }
+	int bindAt(int index, std::nullopt_t) { return bindNullAt(index); }
+	template<typename T>
+	int bindAt(int index, const std::optional<T>& value) { return value ? bindAt(index, *value) : bindNullAt(index); }
+#endif
+	void startRun();
+	int step(); // sqlite3_step() plus any per-step work the owning database needs
+	void checkStatementWarnings();
+	void checkQueryPlan();
+	int limitExceeded() const; // 0, or the reason the statement should be aborted
+	int64_t exportRows(SqlExportWriter& writer, bool json, bool includeHeader);
     sqlite3_stmt* mpVM;
+	SqlDatabase* mpDatabase; // The database that compiled this statement, if known
 	int mBindNext;
 	bool mEndOfRows; // when this is true, currentRow() is invalid.
 	ResultRow mResult;
 	int mColsInResult; // Number of columns in the result set
+	mutable int mNumColumns; // Number of result columns the statement was compiled with
+	mutable SqlColumnMetadata* mpColumns; // Created by columns() on first use
+	int mFullScanBase, mAutoIndexBase; // Counter values at the start of the current run, if a warning handler is set
+	int mPlanReprepares; // Re-prepare count when the plan was last checked, or -1, if a plan change handler is set
+	int mnTimeoutMs;
+	int64_t mDeadlineMs; // End of the current run (monotonic clock), or 0 for none
+	const SqlCancellationToken* mpCancellationToken;
+	bool mNeedsReset; // The statement has been stepped since it was last reset
+	mutable std::vector<std::pair<std::string, int> >* mpParamNames; // Sorted by name; created by param() on first use
+};
+
+// Resets a statement when it goes out of scope, so returning or throwing out of a loop
+// over its rows does not leave a read transaction open:
+//     SqlScopedCursor cursor(statement);
+//     for (cursor->execute(); cursor->hasRow(); cursor->nextRow()) { ... }
+class SqlScopedCursor {
+public:
+	explicit SqlScopedCursor(SqlStatement& rStatement) : mStatement(rStatement) {}
+	~SqlScopedCursor() { mStatement.reset(); }
+
+	SqlStatement& statement() { return mStatement; }
+	SqlStatement* operator->() { return &mStatement; }
+private:
+	SqlScopedCursor(const SqlScopedCursor&);
+	SqlScopedCursor& operator=(const SqlScopedCursor&);
+	SqlStatement& mStatement;
+};
+
+
+// An owned copy of a set of result rows, which stays valid after the statement that
+// produced it has been reset or destroyed. All values live in one buffer, so even a
+// large result costs only a few allocations. Rows and fields are zero-indexed.
+class SqlResultSet {
+public:
+	SqlResultSet() : mNumRows(0) {}
+
+	// Copy the current row and the following rows of rStatement (at most maxRows, or all
+	// if maxRows < 0) onto the end of this result set, leaving rStatement positioned on the
+	// first row not copied. Returns the number of rows copied.
+	int appendRows(SqlStatement& rStatement, int maxRows = -1);
+	// Remove all rows and columns, but keep the allocated memory for reuse
+	void clear();
+	void swap(SqlResultSet& rOther);
+
+	int numRows() const { return mNumRows; }
+	int numFields() const { return (int)mNames.size(); }
+	const char* fieldName(int nField) const;
+	// Approximate number of bytes of memory used by this result set
+	size_t memoryUsed() const;
+
+	SqlType fieldDataType(int nRow, int nField) const { return (SqlType)cell(nRow, nField).type; }
+	bool fieldIsNull(int nRow, int nField) const { return fieldDataType(nRow, nField) == SQLITE_NULL; }
+
+	int getIntField(int nRow, int nField, int nNullValue=0) const { return (int)getInt64Field(nRow, nField, nNullValue); }
+	int64_t getInt64Field(int nRow, int nField, int64_t nNullValue=0) const;
+	double getFloatField(int nRow, int nField, double fNullValue=0.0) const;
+	// For INTEGER and FLOAT values, the returned text is only valid until the next such call
+	const char* getStringField(int nRow, int nField, const char* szNullValue="") const;
+	const unsigned char* getBlobField(int nRow, int nField, int& nLen) const;
+private:
+	struct Cell {
+		int type; // SqlType
+		int len;  // Number of bytes of text/blob data
+		union {
+			int64_t i;
+			double d;
+			size_t offset; // Into mData
+		} value;
+	};
+	const Cell& cell(int nRow, int nField) const;
+
+	std::vector<std::string> mNames;
+	std::vector<Cell> mCells;
+	std::string mData; // Text (NUL-terminated) and blob data
+	int mNumRows;
+	mutable std::string mConverted; // getStringField() result for a numeric value
+};
+
+
+#if CPP_SQL_WRAPPER_CPLUSPLUS >= 201703L
+template<> struct SqlColumnReader<int> {
+	static int read(const SqlStatement::ResultRow& row, int nField) { return row.getIntUnchecked(nField); }
+};
+template<> struct SqlColumnReader<int64_t> {
+	static int64_t read(const SqlStatement::ResultRow& row, int nField) { return row.getInt64Unchecked(nField); }
+};
+template<> struct SqlColumnReader<double> {
+	static double read(const SqlStatement::ResultRow& row, int nField) { return row.getFloatUnchecked(nField); }
+};
+template<> struct SqlColumnReader<bool> {
+	static bool read(const SqlStatement::ResultRow& row, int nField) { return row.getInt64Unchecked(nField) != 0; }
+};
+template<> struct SqlColumnReader<const char*> {
+	static const char* read(const SqlStatement::ResultRow& row, int nField) { return row.getStringUnchecked(nField); }
+};
+template<> struct SqlColumnReader<std::string_view> {
+	static std::string_view read(const SqlStatement::ResultRow& row, int nField) { return row.getStringViewUnchecked(nField); }
+};
+template<> struct SqlColumnReader<std::string> {
+	static std::string read(const SqlStatement::ResultRow& row, int nField) { return std::string(row.getStringViewUnchecked(nField)); }
+};
+template<typename T> struct SqlColumnReader<std::optional<T> > {
+	static std::optional<T> read(const SqlStatement::ResultRow& row, int nField) {
+		if (row.fieldDataTypeUnchecked(nField) == SQLITE_NULL)
+			return std::nullopt;
+		return SqlColumnReader<T>::read(row, nField);
+	}
+};
+#endif
+
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+// A handle to a specific point-in-time view of a WAL-mode database.
+// Requires SQLite to be compiled with SQLITE_ENABLE_SNAPSHOT (and this file to be compiled
+// with the same define). Obtain one with SqlDatabase::takeSnapshot(), then call
+// SqlDatabase::beginSnapshotRead() on any number of other connections to the same file
+// so that they all read exactly the same data.
+// Like SqlStatement, copying a SqlSnapshot transfers ownership of the underlying handle.
+class SqlSnapshot {
+	friend class SqlDatabase;
+public:
+	SqlSnapshot() : mpSnapshot(0) {}
+	SqlSnapshot(const SqlSnapshot& rSnapshot);
+	~SqlSnapshot() { destroy(); }
+	SqlSnapshot& operator=(const SqlSnapshot& rSnapshot);
+
+	bool isValid() const { return mpSnapshot != 0; }
+	// Returns <0 if this snapshot is older than rOther, 0 if they are the same, >0 if newer.
+	// Only meaningful for two snapshots of the same database file.
+	int compare(const SqlSnapshot& rOther) const;
+
+	void destroy();
+private:
+	explicit SqlSnapshot(sqlite3_snapshot* pSnapshot) : mpSnapshot(pSnapshot) {}
+	sqlite3_snapshot* mpSnapshot;
+};
+#endif
+
+
+// A set of SQL statements declared once (typically at startup, before any database uses
+// them) and identified by consecutive integer ids. Each SqlDatabase that uses the registry
+// compiles its own copy of each statement, and looks it up by id with a plain array index,
+// which suits connection pools where every connection runs the same statements.
+class SqlStatementRegistry {
+public:
+	// Declare a statement. Returns its id, for use with SqlDatabase::statement().
+	int declare(const char* szSQL, unsigned int flags = PREPARE_PERSISTENT);
+	int declare(const std::string& szSQL, unsigned int flags = PREPARE_PERSISTENT) { return declare(szSQL.c_str(), flags); }
+
+	int size() const { return (int)mStatements.size(); }
+	const std::string& sql(int id) const;
+	unsigned int flags(int id) const;
+private:
+	struct Declared {
+		std::string sql;
+		unsigned int flags; // SqlPrepareFlags
+	};
+	std::vector<Declared> mStatements;
 };
 
 
@@ -176,8 +807,24 @@ public:
 
 	///////// Methods for executing SQL commands and queries /////////////////////////////////
 
-    SqlStatement sqlCompile(const char* szSQL);
-	SqlStatement sqlCompile(const std::string& szSQL) { return sqlCompile(szSQL.c_str()); }
+	// Compile a single SQL statement for repeated use. flags is a combination of SqlPrepareFlags;
+	// pass PREPARE_PERSISTENT for statements that will be kept for a long time, so that SQLite
+	// allocates them from the heap and leaves its lookaside memory for short-lived work.
+	// (Flags are ignored with SQLite versions before 3.20.0.)
+    SqlStatement sqlCompile(const char* szSQL, unsigned int flags = 0);
+	SqlStatement sqlCompile(const std::string& szSQL, unsigned int flags = 0) { return sqlCompile(szSQL.c_str(), flags); }
+
+	// Use the statements declared in rRegistry (which must outlive this database). If
+	// prepareNow is true they are all compiled immediately, which reports any errors at
+	// startup; otherwise each is compiled the first time statement() asks for it.
+	void useStatementRegistry(const SqlStatementRegistry& rRegistry, bool prepareNow = false);
+	// Get this connection's copy of the registered statement with the given id.
+	// The statement belongs to the database, which destroys it in close().
+	SqlStatement& statement(int id) {
+		if ((unsigned int)id < mRegisteredStatements.size() && mRegisteredStatements[id])
+			return *mRegisteredStatements[id];
+		return compileRegisteredStatement(id);
+	}
 
 	// Execute the given SQL code.
 	void sqlExecute(const char* szSQL);
@@ -209,6 +856,8 @@ public:
 	// Get the number of rows changed by the previous statement completed on this database:
 	// This only counts changes by INSERT, UPDATE, and DELETE
 	int numberOfRowsChanged() const;
+	// True if a transaction has been started with BEGIN and not yet committed or rolled back
+	bool inTransaction() const;
 	
 	///////// Helpful Shortcut Methods ///////////////////////////////////////////////////////
 	
@@ -221,18 +870,142 @@ public:
 
     void interrupt(); // Abort any pending database operations
     void setBusyTimeout(int nMillisecs);
+	// How many VM instructions SQLite runs between checks of the running statement's
+	// timeout and cancellation token (default 1000). Lower values abort sooner, but check
+	// more often. The check is only installed once a statement with limits has run.
+	void setProgressCheckInterval(int nInstructions);
     static const char* SQLiteVersion();
 
 	// If you want all SQL code to be traced out before each query, you can use this to
 	// set a custom handler. The const char* parameter will be the full SQL query.
 	void setSqlTraceHandler(void(*pHandler)(void*,const char*), void* customArg = 0);
 
+	// Run a checkpoint on a WAL-mode database. If pnLogFrames / pnCheckpointedFrames are given,
+	// they receive the size of the WAL in frames and the number of frames now checkpointed.
+	// Returns false if the checkpoint could not run to completion because the database was
+	// busy or locked; throws on any other error.
+	bool walCheckpoint(SqlCheckpointMode mode = CHECKPOINT_PASSIVE, int* pnLogFrames = 0, int* pnCheckpointedFrames = 0);
+	// Set how many WAL frames trigger an automatic checkpoint on commit (0 disables them)
+	void setWalAutoCheckpoint(int nFrames);
+
+	///////// Change notifications ////////////////////////////////////////////////////////
+
+	// Register a handler to be called after a transaction that changed szTable commits
+	// (pass NULL for szTable to hear about changes to any table). The handler receives the
+	// table name and is called at most once per table per transaction, never for changes
+	// that are rolled back. Notifications are delivered on the committing thread, as soon
+	// as the statement that committed returns; handlers may run further SQL.
+	// Only changes made through this connection are reported. SQLite does not say which
+	// table changed for a WITHOUT ROWID table, or for "DELETE FROM t" with no WHERE clause
+	// (which it runs as a truncate); when a transaction changed rows that were not
+	// accounted for, every handler is called once more with a NULL table name, meaning
+	// "tables unknown". A table changed only inside a savepoint that was rolled back with
+	// ROLLBACK TO is still reported when the transaction commits, since SQLite does not
+	// report partial rollbacks.
+	// Register and remove handlers before the connection is shared between threads.
+	// Returns an id that can be passed to removeChangeHandler().
+	int onChange(const char* szTable, void(*pHandler)(void*,const char*), void* customArg = 0);
+	void removeChangeHandler(int handlerId);
+
+	///////// Diagnostics //////////////////////////////////////////////////////////////////
+
+	// Call pHandler whenever a single run of a statement compiled by this database (from
+	// execute() to its last row) takes at least nFullScanSteps full-scan steps, or inserts
+	// at least nAutoIndexRows rows into automatic indexes. Either threshold may be 0 to
+	// disable it. Pass NULL as pHandler to remove the handler.
+	void setStatementWarningHandler(void(*pHandler)(void*,const char* szSQL,const SqlStatementStats&),
+		void* customArg = 0, int nFullScanSteps = 10000, int nAutoIndexRows = 1000);
+
+	// Record the query plan of each distinct SQL statement compiled by this database the
+	// first time it is executed, and check it again whenever the statement is compiled
+	// again or re-prepared (e.g. after a schema change or ANALYZE). If the plan has changed,
+	// pHandler is called with the old and new plans; compare their numFullScans() to spot
+	// a SEARCH that has turned into a SCAN. Pass NULL as pHandler to stop checking.
+	void setPlanChangeHandler(void(*pHandler)(void*,const char* szSQL,const SqlQueryPlan& oldPlan,const SqlQueryPlan& newPlan),
+		void* customArg = 0);
+
+	// List the statements on this connection that are part-way through their result rows,
+	// and so are holding a read transaction open. For debugging a WAL file that keeps
+	// growing. If tracking is enabled (setOpenStatementTracking(true)) each statement's
+	// age is known, and only those open for at least minAgeMs are listed; statements
+	// executed while tracking was off are always listed, with an openMs of -1.
+	std::vector<SqlOpenStatement> openStatements(int minAgeMs = 0) const;
+	// Record the time each statement starts returning rows (costs a map insert per execute())
+	void setOpenStatementTracking(bool enable);
+
+	// The underlying SQLite connection, for use by add-on components (e.g. SqlCheckpointer)
+	sqlite3* handle() const { return mpDB; }
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+	///////// Snapshots (WAL mode only) //////////////////////////////////////////////////////
+	// For sharing a snapshot between connections, open them with useExclusiveWAL = false
+	// and set "PRAGMA journal_mode=WAL" yourself, since exclusive locking mode prevents
+	// any other connection from opening the file.
+
+	// Record the current state of the database. If no transaction is open, this begins a
+	// read transaction, which is left open so that the snapshot cannot be checkpointed away
+	// while other connections are using it. Call endRead() once they are done.
+	SqlSnapshot takeSnapshot();
+	// Begin a read transaction on this connection that sees exactly the given snapshot.
+	// Throws if the snapshot is no longer available (e.g. the WAL has since been reset).
+	void beginSnapshotRead(const SqlSnapshot& rSnapshot);
+	// End the read transaction started by takeSnapshot() or beginSnapshotRead()
+	void endRead();
+#endif
+
 private:
+	friend class SqlStatement;
+	friend struct SqlDatabaseHooks;
     SqlDatabase(const SqlDatabase& db);
     SqlDatabase& operator=(const SqlDatabase& db);
 
+	// Call the change handlers for any transactions that have committed since last time
+	void deliverChanges() { if (!mChangeHandlers.empty()) deliverChangeNotifications(); }
+	void deliverChangeNotifications();
+	SqlStatement& compileRegisteredStatement(int id);
+	void enableProgressChecks();
+	void recordOpenStatement(sqlite3_stmt* pVM);
+	void pruneOpenStatementTimes() const;
+	void destroyRegisteredStatements();
+
     sqlite3* mpDB;
     int mnBusyTimeoutMs;
+
+	int mnProgressInterval;
+	bool mProgressChecksEnabled;
+	const SqlStatement* mpLimitedStatement; // The statement with limits that is currently stepping
+	int mAbortReason; // Why the progress handler interrupted mpLimitedStatement, or 0
+
+	const SqlStatementRegistry* mpRegistry;
+	std::vector<SqlStatement*> mRegisteredStatements; // By id; NULL until compiled
+
+	struct ChangeHandler {
+		int id;
+		std::string table; // empty to match all tables
+		void(*pHandler)(void*,const char*);
+		void* pArg;
+	};
+	std::vector<ChangeHandler> mChangeHandlers;
+	int mNextChangeHandlerId;
+	// Filled by the SQLite hooks on whichever thread steps the connection, so only
+	// touched while holding the connection's mutex (sqlite3_db_mutex())
+	std::set<std::string> mPendingChanges;   // Tables changed by the open transaction
+	std::set<std::string> mCommittedChanges; // Tables changed by committed transactions, not yet notified
+	int mChangesBase;          // sqlite3_total_changes() when changes were last delivered
+	int mReportedChanges;      // Rows reported to the update hook since then
+	bool mCommitted;           // A transaction has committed since then
+
+	void(*mpStatementWarningHandler)(void*,const char*,const SqlStatementStats&);
+	void* mpStatementWarningArg;
+	int mnWarnFullScanSteps, mnWarnAutoIndexRows;
+
+	void(*mpPlanChangeHandler)(void*,const char*,const SqlQueryPlan&,const SqlQueryPlan&);
+	void* mpPlanChangeArg;
+	std::map<std::string, SqlQueryPlan> mKnownPlans; // By SQL text
+
+	bool mTrackOpenStatements;
+	mutable std::map<sqlite3_stmt*, int64_t> mOpenStatementTimes; // When each statement's current run started
+	size_t mnOpenStatementPruneAt; // Drop finished statements from mOpenStatementTimes at this size
 };
 
 #endif
@@ -0,0 +1,176 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#include "SqlAsync.h"
+
+SqlExecutor::SqlExecutor(int numThreads) : mStopping(false) {
+	if (numThreads < 1)
+		numThreads = 1;
+	for (int i = 0; i < numThreads; i++)
+		mThreads.push_back(std::thread(&SqlExecutor::run, this));
+}
+
+SqlExecutor::~SqlExecutor() {
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mWake.notify_all();
+	for (size_t i = 0; i < mThreads.size(); i++)
+		mThreads[i].join();
+}
+
+void SqlExecutor::post(std::function<void()> job) {
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mJobs.push_back(std::move(job));
+	}
+	mWake.notify_one();
+}
+
+void SqlExecutor::run() {
+	std::unique_lock<std::mutex> lock(mMutex);
+	for (;;) {
+		mWake.wait(lock, [this]() { return mStopping || !mJobs.empty(); });
+		if (mJobs.empty())
+			return; // Stopping, and nothing left to do
+		std::function<void()> job = std::move(mJobs.front());
+		mJobs.pop_front();
+		lock.unlock();
+		job();
+		lock.lock();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+SqlAsyncCursor& SqlAsyncCursor::operator=(SqlAsyncCursor&& rOther) {
+	if (this != &rOther) {
+		release();
+		mpDB = rOther.mpDB;
+		mpState = std::move(rOther.mpState);
+	}
+	return *this;
+}
+
+SqlAsyncCursor::~SqlAsyncCursor() {
+	release();
+}
+
+void SqlAsyncCursor::release() {
+	if (!mpState)
+		return;
+	// Finalize the statement on the executor, after any operation already queued for it
+	State* pState = mpState.release();
+	mpDB->submit([pState]() { delete pState; });
+}
+
+SqlAsyncOp<bool> SqlAsyncCursor::next() {
+	if (!mpState)
+		throw SqlDatabaseException("next() called on a cursor that has been moved from.");
+	State* pState = mpState.get();
+	return SqlAsyncOp<bool>(*mpDB, [pState](SqlDatabase& db) {
+		pState->batch.clear();
+		if (!pState->started) {
+			pState->started = true;
+			pState->statement = db.sqlCompile(pState->sql);
+			for (size_t i = 0; i < pState->params.size(); i++)
+				pState->statement.bind(pState->params[i]);
+			pState->statement.execute();
+		} else if (!pState->statement.hasRow()) {
+			return false;
+		}
+		return pState->batch.appendRows(pState->statement, pState->batchSize) > 0;
+	});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+SqlAsyncDatabase::SqlAsyncDatabase(SqlExecutor& rExecutor, const char* szFile, bool useExclusiveWAL)
+	: mExecutor(rExecutor), mDB(szFile, useExclusiveWAL), mpResumer(0), mpResumerArg(0), mScheduled(false)
+{}
+
+SqlAsyncDatabase::~SqlAsyncDatabase() {
+	std::unique_lock<std::mutex> lock(mMutex);
+	mIdle.wait(lock, [this]() { return !mScheduled; });
+}
+
+void SqlAsyncDatabase::setResumer(void(*pResumer)(void*, std::coroutine_handle<>), void* customArg) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mpResumer = pResumer;
+	mpResumerArg = customArg;
+}
+
+SqlAsyncOp<SqlResultSet> SqlAsyncDatabase::queryAsync(std::string sql, std::vector<SqlValue> params) {
+	return SqlAsyncOp<SqlResultSet>(*this, [sql = std::move(sql), params = std::move(params)](SqlDatabase& db) {
+		SqlStatement statement = db.sqlCompile(sql);
+		for (size_t i = 0; i < params.size(); i++)
+			statement.bind(params[i]);
+		statement.execute();
+		SqlResultSet result;
+		result.appendRows(statement);
+		return result;
+	});
+}
+
+SqlAsyncOp<int> SqlAsyncDatabase::execAsync(std::string sql, std::vector<SqlValue> params) {
+	return SqlAsyncOp<int>(*this, [sql = std::move(sql), params = std::move(params)](SqlDatabase& db) {
+		SqlStatement statement = db.sqlCompile(sql);
+		for (size_t i = 0; i < params.size(); i++)
+			statement.bind(params[i]);
+		statement.execute();
+		return db.numberOfRowsChanged();
+	});
+}
+
+SqlAsyncCursor SqlAsyncDatabase::openCursor(std::string sql, std::vector<SqlValue> params, int batchSize) {
+	std::unique_ptr<SqlAsyncCursor::State> pState(new SqlAsyncCursor::State());
+	pState->sql = std::move(sql);
+	pState->params = std::move(params);
+	pState->batchSize = batchSize > 0 ? batchSize : 1;
+	pState->started = false;
+	return SqlAsyncCursor(*this, std::move(pState));
+}
+
+void SqlAsyncDatabase::submit(std::function<void()> job) {
+	bool schedule;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mJobs.push_back(std::move(job));
+		schedule = !mScheduled;
+		mScheduled = true;
+	}
+	if (schedule)
+		mExecutor.post([this]() { drain(); });
+}
+
+void SqlAsyncDatabase::drain() {
+	// Runs this connection's jobs one after another on a single executor thread, so the
+	// connection is never used by two threads at once
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (!mJobs.empty()) {
+		std::function<void()> job = std::move(mJobs.front());
+		mJobs.pop_front();
+		lock.unlock();
+		job();
+		lock.lock();
+	}
+	mScheduled = false;
+	mIdle.notify_all();
+}
+
+void SqlAsyncDatabase::resume(std::coroutine_handle<> coroutine) {
+	void(*pResumer)(void*, std::coroutine_handle<>);
+	void* pArg;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		pResumer = mpResumer;
+		pArg = mpResumerArg;
+	}
+	if (pResumer)
+		pResumer(pArg, coroutine);
+	else
+		coroutine.resume();
+}
@@ -0,0 +1,178 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// SqlAsync - runs queries on a pool of executor threads so that coroutines can
+// co_await them instead of blocking the calling (event loop) thread.
+// Requires C++20.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef CPP_SQL_ASYNC_H
+#define CPP_SQL_ASYNC_H
+
+#include "CppSqlWrapper.h"
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+// A fixed pool of threads that runs posted jobs in FIFO order
+class SqlExecutor {
+public:
+	explicit SqlExecutor(int numThreads = 2);
+	~SqlExecutor(); // Runs any jobs still queued, then joins the threads
+
+	void post(std::function<void()> job);
+	int numThreads() const { return (int)mThreads.size(); }
+
+private:
+	SqlExecutor(const SqlExecutor&);
+	SqlExecutor& operator=(const SqlExecutor&);
+
+	void run();
+
+	std::vector<std::thread> mThreads;
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::deque<std::function<void()>> mJobs;
+	bool mStopping;
+};
+
+class SqlAsyncDatabase;
+
+// The result of an asynchronous operation. Nothing runs until it is co_awaited; the
+// awaiting coroutine is then suspended until the operation has finished on an executor
+// thread, and co_await yields the result (or rethrows the exception the operation threw).
+// Await each operation exactly once.
+template<typename T>
+class SqlAsyncOp {
+public:
+	SqlAsyncOp(SqlAsyncDatabase& rDB, std::function<T(SqlDatabase&)> fn) : mpDB(&rDB), mFn(std::move(fn)) {}
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> coroutine);
+	T await_resume() {
+		if (mError)
+			std::rethrow_exception(mError);
+		if constexpr (!std::is_void_v<T>)
+			return std::move(*mResult);
+	}
+
+private:
+	SqlAsyncDatabase* mpDB;
+	std::function<T(SqlDatabase&)> mFn;
+	std::optional<std::conditional_t<std::is_void_v<T>, char, T>> mResult;
+	std::exception_ptr mError;
+};
+
+// Reads the rows of a query a batch at a time:
+//     SqlAsyncCursor cursor = db.openCursor("SELECT ...", {minId});
+//     while (co_await cursor.next())
+//         for (int i = 0; i < cursor.batch().numRows(); i++) ...
+// Do not call next() again until the previous next() has completed.
+class SqlAsyncCursor {
+	friend class SqlAsyncDatabase;
+public:
+	SqlAsyncCursor(SqlAsyncCursor&&) = default;
+	SqlAsyncCursor& operator=(SqlAsyncCursor&& rOther);
+	~SqlAsyncCursor(); // The statement is destroyed on the executor, without blocking
+
+	// Fetch the next batch of rows into batch(). Yields false when there are no more rows.
+	SqlAsyncOp<bool> next();
+	// The rows fetched by the last next(); only valid until next() is awaited again
+	const SqlResultSet& batch() const { return mpState->batch; }
+
+private:
+	struct State {
+		std::string sql;
+		std::vector<SqlValue> params;
+		int batchSize;
+		SqlStatement statement;
+		bool started;
+		SqlResultSet batch;
+	};
+	SqlAsyncCursor(SqlAsyncDatabase& rDB, std::unique_ptr<State> pState) : mpDB(&rDB), mpState(std::move(pState)) {}
+	void release();
+
+	SqlAsyncDatabase* mpDB;
+	std::unique_ptr<State> mpState;
+};
+
+// A database connection whose SQLite work all runs on a SqlExecutor. Operations on one
+// SqlAsyncDatabase run one at a time, in the order they were awaited; use several
+// SqlAsyncDatabase objects (on the same executor) to run queries in parallel.
+class SqlAsyncDatabase {
+	template<typename T> friend class SqlAsyncOp;
+	friend class SqlAsyncCursor;
+public:
+	// Opens the database on the calling thread, so do this at startup.
+	// rExecutor must outlive this object.
+	SqlAsyncDatabase(SqlExecutor& rExecutor, const char* szFile, bool useExclusiveWAL = true);
+	// Waits for any queued operations to finish. Destroy cursors first, and do not destroy
+	// the database from a coroutine that is running on the executor.
+	~SqlAsyncDatabase();
+
+	// By default, a coroutine resumes on the executor thread that ran its operation. An
+	// event loop can instead install a resumer that posts the handle back to the loop
+	// thread, which then calls resume() on it.
+	void setResumer(void(*pResumer)(void*, std::coroutine_handle<>), void* customArg = 0);
+
+	// Run any function of the form T fn(SqlDatabase&) on the executor
+	template<typename Fn>
+	auto runAsync(Fn fn) -> SqlAsyncOp<decltype(fn(std::declval<SqlDatabase&>()))> {
+		return SqlAsyncOp<decltype(fn(std::declval<SqlDatabase&>()))>(*this, std::move(fn));
+	}
+	// Run a single SQL statement with the given parameters and collect all its result rows
+	SqlAsyncOp<SqlResultSet> queryAsync(std::string sql, std::vector<SqlValue> params = {});
+	// Run a single SQL statement with the given parameters; yields the number of rows changed
+	SqlAsyncOp<int> execAsync(std::string sql, std::vector<SqlValue> params = {});
+	// Open a cursor that fetches the result rows batchSize rows at a time
+	SqlAsyncCursor openCursor(std::string sql, std::vector<SqlValue> params = {}, int batchSize = 256);
+
+private:
+	SqlAsyncDatabase(const SqlAsyncDatabase&);
+	SqlAsyncDatabase& operator=(const SqlAsyncDatabase&);
+
+	void submit(std::function<void()> job);
+	void drain();
+	void resume(std::coroutine_handle<> coroutine);
+
+	SqlExecutor& mExecutor;
+	SqlDatabase mDB;
+	void(*mpResumer)(void*, std::coroutine_handle<>);
+	void* mpResumerArg;
+
+	std::mutex mMutex;
+	std::condition_variable mIdle;
+	std::deque<std::function<void()>> mJobs;
+	bool mScheduled; // A drain() is queued on or running on the executor
+};
+
+template<typename T>
+void SqlAsyncOp<T>::await_suspend(std::coroutine_handle<> coroutine) {
+	SqlAsyncDatabase* pDB = mpDB;
+	// The coroutine (and so this object) may be resumed and gone before submit() returns
+	pDB->submit([this, pDB, coroutine]() {
+		try {
+			if constexpr (std::is_void_v<T>) {
+				mFn(pDB->mDB);
+				mResult.emplace();
+			} else {
+				mResult.emplace(mFn(pDB->mDB));
+			}
+		} catch (...) {
+			mError = std::current_exception();
+		}
+		pDB->resume(coroutine);
+	});
+}
+
+#endif
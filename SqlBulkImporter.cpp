@@ -0,0 +1,658 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#include "SqlBulkImporter.h"
+
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <cstdio>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+////////////////////////////////////////////////////////////////////////////////
+// Parsed rows. Text is stored NUL-terminated in one buffer per batch, so a batch
+// costs a handful of allocations no matter how many rows it holds, and batches
+// are recycled once the writer has inserted them.
+
+enum ValueType { VALUE_NULL, VALUE_INT, VALUE_FLOAT, VALUE_TEXT };
+
+struct Value {
+	ValueType type;
+	int64_t i;
+	double d;
+	size_t offset; // VALUE_TEXT: offset into RowBatch::text
+};
+
+struct RowBatch {
+	int64_t seq;
+	int64_t nRows;
+	std::vector<Value> values; // nRows * number of columns
+	std::string text;
+	void clear() { nRows = 0; values.clear(); text.clear(); }
+};
+
+inline Value nullValue() { Value v; v.type = VALUE_NULL; v.i = 0; v.d = 0; v.offset = 0; return v; }
+
+class ParseError : public SqlDatabaseException {
+public:
+	ParseError(const char* reason) : SqlDatabaseException(std::string("Import failed: ").append(reason)) {}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Record boundaries
+
+// Find the end of the CSV record that contains 'target', given that 'start' is the
+// beginning of a record. Newlines inside quoted fields do not end a record.
+const char* findCsvRecordEnd(const char* start, const char* target, const char* end) {
+	bool inQuotes = false;
+	const char* p = start;
+	while (p < target) {
+		const char* q = (const char*)memchr(p, '"', target - p);
+		if (!q)
+			break;
+		inQuotes = !inQuotes;
+		p = q + 1;
+	}
+	for (p = target; p < end; ++p) {
+		if (*p == '"')
+			inQuotes = !inQuotes;
+		else if (*p == '\n' && !inQuotes)
+			return p + 1;
+	}
+	return end;
+}
+
+const char* findLineEnd(const char* target, const char* end) {
+	if (target >= end)
+		return end;
+	const char* q = (const char*)memchr(target, '\n', end - target);
+	return q ? q + 1 : end;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Parsing (one Parser per worker thread)
+
+class Parser {
+public:
+	Parser(const std::vector<std::string>& columns, const SqlImportOptions& options)
+		: mColumns(columns), mOptions(options), mNumCols(columns.size()) {}
+
+	void parse(const char* p, const char* end, RowBatch& batch) {
+		// A blank line is an empty record when there is a single CSV column; otherwise skip it
+		const bool skipBlankLines = mOptions.format != IMPORT_CSV || mNumCols > 1;
+		while (p < end) {
+			if (skipBlankLines) {
+				if (*p == '\n') { ++p; continue; }
+				if (*p == '\r' && p + 1 < end && p[1] == '\n') { p += 2; continue; }
+			}
+			if (mOptions.format == IMPORT_CSV)
+				parseCsvRecord(p, end, batch);
+			else
+				parseJsonRecord(p, end, batch);
+			batch.nRows++;
+		}
+	}
+
+private:
+	static Value textValue(size_t offset) {
+		Value v = nullValue();
+		v.type = VALUE_TEXT;
+		v.offset = offset;
+		return v;
+	}
+
+	void parseCsvRecord(const char*& p, const char* end, RowBatch& batch) {
+		size_t nFields = 0;
+		for (;;) {
+			Value v;
+			if (p < end && *p == '"') {
+				++p;
+				const size_t offset = batch.text.size();
+				for (;;) {
+					const char* q = (p < end) ? (const char*)memchr(p, '"', end - p) : 0;
+					if (!q)
+						throw ParseError("unterminated quoted CSV field.");
+					batch.text.append(p, q - p);
+					p = q + 1;
+					if (p < end && *p == '"') {
+						batch.text.push_back('"'); // "" is an escaped quote
+						++p;
+					} else {
+						break;
+					}
+				}
+				batch.text.push_back('\0');
+				v = textValue(offset);
+			} else {
+				const char* start = p;
+				while (p < end && *p != ',' && *p != '\n')
+					++p;
+				const char* fieldEnd = p;
+				if (fieldEnd > start && fieldEnd[-1] == '\r' && (p == end || *p == '\n'))
+					--fieldEnd;
+				if (fieldEnd == start && mOptions.csvEmptyIsNull) {
+					v = nullValue();
+				} else {
+					v = textValue(batch.text.size());
+					batch.text.append(start, fieldEnd - start);
+					batch.text.push_back('\0');
+				}
+			}
+			if (++nFields > mNumCols)
+				throw ParseError("CSV record has more fields than there are columns.");
+			batch.values.push_back(v);
+
+			if (p >= end)
+				break;
+			if (*p == ',') {
+				++p;
+				continue;
+			}
+			if (*p == '\r')
+				++p;
+			if (p < end && *p == '\n') {
+				++p;
+				break;
+			}
+			if (p < end)
+				throw ParseError("unexpected character after quoted CSV field.");
+		}
+		if (nFields != mNumCols)
+			throw ParseError("CSV record has fewer fields than there are columns.");
+	}
+
+	static void skipSpace(const char*& p, const char* end) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+			++p;
+	}
+	static void expect(const char*& p, const char* end, char c) {
+		if (p >= end || *p != c)
+			throw ParseError("malformed JSON.");
+		++p;
+	}
+	static void appendUtf8(std::string& out, unsigned long cp) {
+		if (cp < 0x80) {
+			out.push_back((char)cp);
+		} else if (cp < 0x800) {
+			out.push_back((char)(0xC0 | (cp >> 6)));
+			out.push_back((char)(0x80 | (cp & 0x3F)));
+		} else if (cp < 0x10000) {
+			out.push_back((char)(0xE0 | (cp >> 12)));
+			out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+			out.push_back((char)(0x80 | (cp & 0x3F)));
+		} else {
+			out.push_back((char)(0xF0 | (cp >> 18)));
+			out.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+			out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+			out.push_back((char)(0x80 | (cp & 0x3F)));
+		}
+	}
+	static unsigned long parseHex4(const char*& p, const char* end) {
+		if (end - p < 4)
+			throw ParseError("malformed JSON \\u escape.");
+		unsigned long cp = 0;
+		for (int i = 0; i < 4; i++, p++) {
+			const char c = *p;
+			cp <<= 4;
+			if (c >= '0' && c <= '9') cp |= (unsigned long)(c - '0');
+			else if (c >= 'a' && c <= 'f') cp |= (unsigned long)(c - 'a' + 10);
+			else if (c >= 'A' && c <= 'F') cp |= (unsigned long)(c - 'A' + 10);
+			else throw ParseError("malformed JSON \\u escape.");
+		}
+		return cp;
+	}
+	// Parse a JSON string (p is just past the opening quote) and append it, unescaped, to out
+	static void parseJsonString(const char*& p, const char* end, std::string& out) {
+		for (;;) {
+			const char* start = p;
+			while (p < end && *p != '"' && *p != '\\')
+				++p;
+			out.append(start, p - start);
+			if (p >= end)
+				throw ParseError("unterminated JSON string.");
+			if (*p++ == '"')
+				return;
+			if (p >= end)
+				throw ParseError("unterminated JSON string.");
+			const char c = *p++;
+			switch (c) {
+				case '"': case '\\': case '/': out.push_back(c); break;
+				case 'b': out.push_back('\b'); break;
+				case 'f': out.push_back('\f'); break;
+				case 'n': out.push_back('\n'); break;
+				case 'r': out.push_back('\r'); break;
+				case 't': out.push_back('\t'); break;
+				case 'u': {
+					unsigned long cp = parseHex4(p, end);
+					if (cp >= 0xDC00 && cp < 0xE000)
+						throw ParseError("invalid UTF-16 surrogate pair in JSON string.");
+					if (cp >= 0xD800 && cp < 0xDC00) {
+						if (end - p < 6 || p[0] != '\\' || p[1] != 'u')
+							throw ParseError("invalid UTF-16 surrogate pair in JSON string.");
+						p += 2;
+						const unsigned long low = parseHex4(p, end);
+						if (low < 0xDC00 || low >= 0xE000)
+							throw ParseError("invalid UTF-16 surrogate pair in JSON string.");
+						cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+					}
+					appendUtf8(out, cp);
+					break;
+				}
+				default:
+					throw ParseError("invalid JSON escape sequence.");
+			}
+		}
+	}
+	// Skip over a nested object or array (p is at the opening bracket)
+	static void skipJsonContainer(const char*& p, const char* end) {
+		int depth = 0;
+		while (p < end) {
+			const char c = *p++;
+			if (c == '"') {
+				while (p < end && *p != '"')
+					p += (*p == '\\') ? 2 : 1;
+				++p;
+			} else if (c == '{' || c == '[') {
+				depth++;
+			} else if (c == '}' || c == ']') {
+				if (--depth == 0)
+					return;
+			}
+		}
+		throw ParseError("unterminated JSON object or array.");
+	}
+	static Value parseJsonValue(const char*& p, const char* end, RowBatch& batch) {
+		if (p >= end)
+			throw ParseError("malformed JSON.");
+		Value v = nullValue();
+		const char c = *p;
+		if (c == '"') {
+			++p;
+			v = textValue(batch.text.size());
+			parseJsonString(p, end, batch.text);
+			batch.text.push_back('\0');
+		} else if (c == '{' || c == '[') {
+			const char* start = p;
+			skipJsonContainer(p, end);
+			v = textValue(batch.text.size());
+			batch.text.append(start, p - start);
+			batch.text.push_back('\0');
+		} else if (c == 't' && end - p >= 4 && memcmp(p, "true", 4) == 0) {
+			p += 4;
+			v.type = VALUE_INT;
+			v.i = 1;
+		} else if (c == 'f' && end - p >= 5 && memcmp(p, "false", 5) == 0) {
+			p += 5;
+			v.type = VALUE_INT;
+			v.i = 0;
+		} else if (c == 'n' && end - p >= 4 && memcmp(p, "null", 4) == 0) {
+			p += 4;
+		} else {
+			char number[64];
+			size_t nLen = 0;
+			bool integral = true;
+			while (p < end && nLen < sizeof(number) - 1 && (isdigit((unsigned char)*p) || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E')) {
+				if (*p == '.' || *p == 'e' || *p == 'E')
+					integral = false;
+				number[nLen++] = *p++;
+			}
+			number[nLen] = '\0';
+			if (nLen == 0)
+				throw ParseError("malformed JSON value.");
+			char* numberEnd = 0;
+			if (integral) {
+				errno = 0;
+				v.i = strtoll(number, &numberEnd, 10);
+				v.type = VALUE_INT;
+				if (errno == ERANGE)
+					integral = false; // Too big for an int64; store it as a float instead
+			}
+			if (!integral) {
+				v.d = strtod(number, &numberEnd);
+				v.type = VALUE_FLOAT;
+			}
+			if (*numberEnd != '\0')
+				throw ParseError("malformed JSON number.");
+		}
+		return v;
+	}
+
+	int columnIndex(const std::string& key) const {
+		for (size_t i = 0; i < mNumCols; i++) {
+			if (mColumns[i] == key)
+				return (int)i;
+		}
+		return -1;
+	}
+
+	void parseJsonRecord(const char*& p, const char* end, RowBatch& batch) {
+		const char* lineEnd = findLineEnd(p, end);
+		const char* recordEnd = (lineEnd > p && lineEnd[-1] == '\n') ? lineEnd - 1 : lineEnd;
+		const size_t base = batch.values.size();
+		batch.values.resize(base + mNumCols, nullValue());
+
+		skipSpace(p, recordEnd);
+		expect(p, recordEnd, '{');
+		skipSpace(p, recordEnd);
+		if (p < recordEnd && *p == '}') {
+			++p;
+		} else {
+			for (;;) {
+				expect(p, recordEnd, '"');
+				mKey.clear();
+				parseJsonString(p, recordEnd, mKey);
+				skipSpace(p, recordEnd);
+				expect(p, recordEnd, ':');
+				skipSpace(p, recordEnd);
+				const size_t textSize = batch.text.size();
+				const Value v = parseJsonValue(p, recordEnd, batch);
+				const int col = columnIndex(mKey);
+				if (col >= 0)
+					batch.values[base + col] = v;
+				else
+					batch.text.resize(textSize); // Not a column we are importing
+				skipSpace(p, recordEnd);
+				if (p < recordEnd && *p == ',') {
+					++p;
+					skipSpace(p, recordEnd);
+					continue;
+				}
+				expect(p, recordEnd, '}');
+				break;
+			}
+		}
+		skipSpace(p, recordEnd);
+		if (p != recordEnd)
+			throw ParseError("unexpected data after JSON object.");
+		p = lineEnd;
+	}
+
+	const std::vector<std::string>& mColumns;
+	const SqlImportOptions& mOptions;
+	const size_t mNumCols;
+	std::string mKey;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// The pipeline: workers claim chunks in order, parse them, and hand batches to the
+// writer, which inserts them strictly in input order.
+
+class ImportPipeline {
+public:
+	ImportPipeline(const char* pData, size_t nLen, const std::vector<std::string>& columns, const SqlImportOptions& options)
+		: mpNext(pData), mpEnd(pData + nLen), mColumns(columns), mOptions(options),
+		  mNextChunkSeq(0), mNextWriteSeq(0), mWorkersRunning(0), mAbort(false)
+	{
+		mNumThreads = options.numThreads > 0 ? options.numThreads : (int)std::thread::hardware_concurrency();
+		if (mNumThreads < 1)
+			mNumThreads = 1;
+		mMaxQueued = options.maxQueuedBatches > 0 ? options.maxQueuedBatches : 2 * mNumThreads;
+		if (options.format == IMPORT_CSV && options.csvHasHeader)
+			mpNext = findCsvRecordEnd(mpNext, mpNext, mpEnd);
+	}
+	~ImportPipeline() {
+		abort();
+		for (size_t i = 0; i < mThreads.size(); i++)
+			mThreads[i].join();
+		for (size_t i = 0; i < mFreeBatches.size(); i++)
+			delete mFreeBatches[i];
+		for (std::map<int64_t, RowBatch*>::iterator it = mReady.begin(); it != mReady.end(); ++it)
+			delete it->second;
+	}
+
+	void start() {
+		mWorkersRunning = mNumThreads;
+		for (int i = 0; i < mNumThreads; i++)
+			mThreads.push_back(std::thread(&ImportPipeline::work, this));
+	}
+
+	// Wait for the next batch in input order. Returns NULL once all input has been written.
+	RowBatch* nextBatch() {
+		std::unique_lock<std::mutex> lock(mMutex);
+		for (;;) {
+			if (mError)
+				std::rethrow_exception(mError);
+			std::map<int64_t, RowBatch*>::iterator it = mReady.find(mNextWriteSeq);
+			if (it != mReady.end()) {
+				RowBatch* pBatch = it->second;
+				mReady.erase(it);
+				mNextWriteSeq++;
+				mSpaceAvailable.notify_all();
+				return pBatch;
+			}
+			if (mWorkersRunning == 0)
+				return 0;
+			mBatchReady.wait(lock);
+		}
+	}
+	void recycle(RowBatch* pBatch) {
+		std::lock_guard<std::mutex> lock(mMutex);
+		mFreeBatches.push_back(pBatch);
+	}
+	void abort() {
+		std::lock_guard<std::mutex> lock(mMutex);
+		mAbort = true;
+		mSpaceAvailable.notify_all();
+	}
+
+private:
+	void work() {
+		Parser parser(mColumns, mOptions);
+		RowBatch* pBatch = 0;
+		try {
+			const char* pChunk;
+			const char* pChunkEnd;
+			while (claimChunk(pBatch, pChunk, pChunkEnd)) {
+				parser.parse(pChunk, pChunkEnd, *pBatch);
+				submit(pBatch);
+				pBatch = 0;
+			}
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (pBatch)
+				mFreeBatches.push_back(pBatch); // The batch that was being parsed
+			if (!mError)
+				mError = std::current_exception();
+			mAbort = true;
+			mSpaceAvailable.notify_all();
+		}
+		std::lock_guard<std::mutex> lock(mMutex);
+		mWorkersRunning--;
+		mBatchReady.notify_all();
+	}
+
+	bool claimChunk(RowBatch*& pBatch, const char*& pChunk, const char*& pChunkEnd) {
+		std::unique_lock<std::mutex> lock(mMutex);
+		if (mAbort || mpNext >= mpEnd)
+			return false;
+		pChunk = mpNext;
+		const char* target = (size_t(mpEnd - mpNext) > mOptions.chunkBytes) ? mpNext + mOptions.chunkBytes : mpEnd;
+		pChunkEnd = (mOptions.format == IMPORT_CSV) ? findCsvRecordEnd(mpNext, target, mpEnd) : findLineEnd(target, mpEnd);
+		mpNext = pChunkEnd;
+		if (mFreeBatches.empty()) {
+			pBatch = new RowBatch();
+		} else {
+			pBatch = mFreeBatches.back();
+			mFreeBatches.pop_back();
+		}
+		pBatch->clear();
+		pBatch->seq = mNextChunkSeq++;
+		return true;
+	}
+
+	void submit(RowBatch* pBatch) {
+		std::unique_lock<std::mutex> lock(mMutex);
+		// Only the batches the writer needs soonest may be queued; waiting on any other
+		// condition could deadlock a worker holding the batch the writer is waiting for.
+		while (!mAbort && pBatch->seq >= mNextWriteSeq + mMaxQueued)
+			mSpaceAvailable.wait(lock);
+		if (mAbort) {
+			mFreeBatches.push_back(pBatch);
+			return;
+		}
+		mReady[pBatch->seq] = pBatch;
+		mBatchReady.notify_all();
+	}
+
+	const char* mpNext;
+	const char* const mpEnd;
+	const std::vector<std::string>& mColumns;
+	const SqlImportOptions& mOptions;
+	int mNumThreads;
+	int64_t mMaxQueued;
+
+	std::vector<std::thread> mThreads;
+	std::mutex mMutex;
+	std::condition_variable mBatchReady;
+	std::condition_variable mSpaceAvailable;
+	int64_t mNextChunkSeq;
+	int64_t mNextWriteSeq;
+	std::map<int64_t, RowBatch*> mReady;
+	std::vector<RowBatch*> mFreeBatches;
+	int mWorkersRunning;
+	bool mAbort;
+	std::exception_ptr mError;
+};
+
+std::string quoteIdentifier(const std::string& name) {
+	std::string result("\"");
+	for (size_t i = 0; i < name.size(); i++) {
+		if (name[i] == '"')
+			result.push_back('"');
+		result.push_back(name[i]);
+	}
+	return result.append("\"");
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+SqlBulkImporter::SqlBulkImporter(SqlDatabase& db, const std::string& szTable, const std::vector<std::string>& columns,
+	const SqlImportOptions& options)
+	: mDB(db), mTable(szTable), mColumns(columns), mOptions(options)
+{
+	if (mColumns.empty())
+		throw SqlDatabaseException("SqlBulkImporter requires at least one column.");
+	if (mOptions.chunkBytes == 0)
+		mOptions.chunkBytes = 1;
+	if (mOptions.rowsPerTransaction < 1)
+		mOptions.rowsPerTransaction = 1;
+}
+
+SqlImportStats SqlBulkImporter::importBuffer(const char* pData, size_t nLen) {
+	std::string sql("INSERT INTO ");
+	sql.append(quoteIdentifier(mTable)).append(" (");
+	for (size_t i = 0; i < mColumns.size(); i++)
+		sql.append(i ? ", " : "").append(quoteIdentifier(mColumns[i]));
+	sql.append(") VALUES (");
+	for (size_t i = 0; i < mColumns.size(); i++)
+		sql.append(i ? ", ?" : "?");
+	sql.append(")");
+
+	SqlImportStats stats;
+	SqlStatement insert = mDB.sqlCompile(sql, PREPARE_PERSISTENT);
+	ImportPipeline pipeline(pData, nLen, mColumns, mOptions);
+	pipeline.start();
+
+	const size_t nCols = mColumns.size();
+	int64_t rowsInTransaction = 0;
+	RowBatch* pBatch = 0;
+	mDB.sqlExecute("BEGIN");
+	try {
+		while ((pBatch = pipeline.nextBatch()) != 0) {
+			const Value* pValue = pBatch->values.empty() ? 0 : &pBatch->values[0];
+			for (int64_t row = 0; row < pBatch->nRows; row++) {
+				for (size_t col = 0; col < nCols; col++, pValue++) {
+					switch (pValue->type) {
+						case VALUE_INT: insert.bind(pValue->i); break;
+						case VALUE_FLOAT: insert.bind(pValue->d); break;
+						case VALUE_TEXT: insert.bind(pBatch->text.c_str() + pValue->offset); break;
+						default: insert.bindNull(); break;
+					}
+				}
+				insert.execute();
+				if (++rowsInTransaction >= mOptions.rowsPerTransaction) {
+					mDB.sqlExecute("COMMIT; BEGIN");
+					stats.transactions++;
+					rowsInTransaction = 0;
+				}
+			}
+			stats.rows += pBatch->nRows;
+			stats.batches++;
+			pipeline.recycle(pBatch);
+			pBatch = 0;
+		}
+		mDB.sqlExecute("COMMIT");
+		stats.transactions++;
+	} catch (...) {
+		if (pBatch)
+			pipeline.recycle(pBatch);
+		pipeline.abort();
+		insert.destroy();
+		try {
+			mDB.sqlExecute("ROLLBACK");
+		} catch (...) {}
+		throw;
+	}
+	return stats;
+}
+
+SqlImportStats SqlBulkImporter::importFile(const char* szPath) {
+#ifdef _WIN32
+	FILE* pFile = fopen(szPath, "rb");
+	if (!pFile)
+		throw SqlDatabaseException(std::string("Unable to open import file: ").append(szPath));
+	std::string contents;
+	char buffer[64 * 1024];
+	size_t nRead;
+	while ((nRead = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+		contents.append(buffer, nRead);
+	fclose(pFile);
+	return importBuffer(contents.data(), contents.size());
+#else
+	const int fd = open(szPath, O_RDONLY);
+	if (fd < 0)
+		throw SqlDatabaseException(std::string("Unable to open import file: ").append(szPath));
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		throw SqlDatabaseException(std::string("Unable to read import file: ").append(szPath));
+	}
+	const size_t nLen = (size_t)info.st_size;
+	if (nLen == 0) {
+		close(fd);
+		return SqlImportStats();
+	}
+	void* pData = mmap(0, nLen, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (pData == MAP_FAILED)
+		throw SqlDatabaseException(std::string("Unable to map import file: ").append(szPath));
+	madvise(pData, nLen, MADV_SEQUENTIAL);
+	try {
+		const SqlImportStats stats = importBuffer((const char*)pData, nLen);
+		munmap(pData, nLen);
+		return stats;
+	} catch (...) {
+		munmap(pData, nLen);
+		throw;
+	}
+#endif
+}
@@ -0,0 +1,68 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// SqlBulkImporter - loads CSV or newline-delimited JSON into a table. The input
+// is memory-mapped and split at record boundaries; worker threads parse the
+// pieces into row batches, which a single writer (the calling thread) inserts
+// in order with one reused SqlStatement inside chunked transactions.
+// Requires C++11.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef CPP_SQL_BULK_IMPORTER_H
+#define CPP_SQL_BULK_IMPORTER_H
+
+#include "CppSqlWrapper.h"
+
+#include <string>
+#include <vector>
+
+enum SqlImportFormat {
+	IMPORT_CSV,    // RFC 4180; fields are matched to columns by position
+	IMPORT_NDJSON, // One JSON object per line; keys are matched to columns by name
+};
+
+struct SqlImportOptions {
+	SqlImportFormat format = IMPORT_CSV;
+	// CSV: skip the first record
+	bool csvHasHeader = true;
+	// CSV: store unquoted empty fields as NULL rather than ''
+	bool csvEmptyIsNull = true;
+	// Number of parsing threads (0 = one per hardware thread)
+	int numThreads = 0;
+	// Approximate size of the piece of input each worker parses at a time
+	size_t chunkBytes = 4 * 1024 * 1024;
+	// Maximum number of parsed batches waiting for the writer (0 = twice numThreads)
+	int maxQueuedBatches = 0;
+	// Commit after this many rows
+	int rowsPerTransaction = 100000;
+};
+
+struct SqlImportStats {
+	int64_t rows = 0;
+	int64_t batches = 0;
+	int64_t transactions = 0;
+};
+
+class SqlBulkImporter {
+public:
+	// Rows will be inserted into the given columns of szTable. For IMPORT_NDJSON, object
+	// keys not in columns are ignored and missing keys are inserted as NULL; nested
+	// objects and arrays are inserted as their JSON text.
+	SqlBulkImporter(SqlDatabase& db, const std::string& szTable, const std::vector<std::string>& columns,
+		const SqlImportOptions& options = SqlImportOptions());
+
+	// Import a whole file. The database must not be inside a transaction.
+	// On error, the import is rolled back to the last committed chunk and an exception is thrown.
+	SqlImportStats importFile(const char* szPath);
+	// Import data that is already in memory
+	SqlImportStats importBuffer(const char* pData, size_t nLen);
+
+private:
+	SqlDatabase& mDB;
+	std::string mTable;
+	std::vector<std::string> mColumns;
+	SqlImportOptions mOptions;
+};
+
+#endif
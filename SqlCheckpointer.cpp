@@ -0,0 +1,177 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#include "SqlCheckpointer.h"
+
+#include <chrono>
+
+#include "sqlite3.h"
+
+SqlCheckpointer::SqlCheckpointer(SqlDatabase& db, const SqlCheckpointPolicy& policy)
+	: mDB(db), mPolicy(policy), mPrevAutoCheckpoint(-1), mStopping(false), mCheckpointRequested(false),
+	  mWalFrames(0), mCheckpointedFrames(0), mpStarvationHandler(0), mpStarvationArg(0)
+{}
+
+SqlCheckpointer::~SqlCheckpointer() {
+	try {
+		stop();
+	} catch (...) {} // Destructors must not propagate exceptions
+}
+
+void SqlCheckpointer::start() {
+	if (isRunning())
+		return;
+	sqlite3* pDB = mDB.handle();
+	if (!pDB)
+		throw SqlDatabaseException("SqlCheckpointer requires an open database.");
+	const char* szFile = sqlite3_db_filename(pDB, "main");
+	if (!szFile || !*szFile)
+		throw SqlDatabaseException("SqlCheckpointer requires a database file.");
+	{
+		SqlStatement lockingMode = mDB.sqlCompile("PRAGMA locking_mode");
+		lockingMode.execute();
+		if (lockingMode.hasRow() && sqlite3_stricmp(lockingMode.currentRow().getStringField(0), "exclusive") == 0)
+			throw SqlDatabaseException("SqlCheckpointer requires the normal locking mode, as it checkpoints on a second connection.");
+	}
+	mpCheckpointDB.reset(new SqlDatabase(szFile, false));
+	{
+		// Reading the journal mode also opens the WAL on the new connection, which a
+		// checkpoint would otherwise not do
+		SqlStatement journalMode = mpCheckpointDB->sqlCompile("PRAGMA journal_mode");
+		journalMode.execute();
+		if (!journalMode.hasRow() || sqlite3_stricmp(journalMode.currentRow().getStringField(0), "wal") != 0) {
+			journalMode.destroy();
+			mpCheckpointDB.reset();
+			throw SqlDatabaseException("SqlCheckpointer requires a database in WAL mode.");
+		}
+	}
+	mPrevAutoCheckpoint = mDB.getScalar("PRAGMA wal_autocheckpoint", 1000);
+	mStopping = false;
+	mCheckpointRequested = false;
+	// Installing our own WAL hook replaces SQLite's autocheckpoint hook, so writers no
+	// longer checkpoint inline; they just tell us how big the WAL has become.
+	sqlite3_wal_hook(pDB, &SqlCheckpointer::walHook, this);
+	mThread = std::thread(&SqlCheckpointer::run, this);
+}
+
+void SqlCheckpointer::stop() {
+	if (!isRunning())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mWake.notify_one();
+	mThread.join();
+	mpCheckpointDB.reset();
+	if (mDB.handle())
+		mDB.setWalAutoCheckpoint(mPrevAutoCheckpoint); // This also removes our WAL hook
+}
+
+void SqlCheckpointer::requestCheckpoint() {
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mCheckpointRequested = true;
+	}
+	mWake.notify_one();
+}
+
+SqlCheckpointMetrics SqlCheckpointer::metrics() const {
+	std::lock_guard<std::mutex> lock(mMetricsMutex);
+	SqlCheckpointMetrics result = mMetrics;
+	result.walFrames = mWalFrames;
+	return result;
+}
+
+void SqlCheckpointer::setStarvationHandler(void(*pHandler)(void*, const SqlCheckpointMetrics&), void* customArg) {
+	std::lock_guard<std::mutex> lock(mMetricsMutex);
+	mpStarvationHandler = pHandler;
+	mpStarvationArg = customArg;
+}
+
+int SqlCheckpointer::walHook(void* pArg, sqlite3*, const char*, int nFrames) {
+	// Called by SQLite on the committing thread, after each commit
+	SqlCheckpointer* self = static_cast<SqlCheckpointer*>(pArg);
+	self->mWalFrames = nFrames;
+	int done = self->mCheckpointedFrames;
+	if (nFrames < done) {
+		// The WAL has been restarted from the beginning since the last checkpoint
+		done = 0;
+		self->mCheckpointedFrames = 0;
+	}
+	if (self->mPolicy.walFrameThreshold > 0 && nFrames - done >= self->mPolicy.walFrameThreshold)
+		self->requestCheckpoint();
+	return SQLITE_OK;
+}
+
+void SqlCheckpointer::run() {
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (!mStopping) {
+		if (!mCheckpointRequested) {
+			if (mPolicy.maxIntervalMs > 0)
+				mWake.wait_for(lock, std::chrono::milliseconds(mPolicy.maxIntervalMs));
+			else
+				mWake.wait(lock);
+		}
+		if (mStopping)
+			break;
+		const bool requested = mCheckpointRequested;
+		mCheckpointRequested = false;
+		if (!requested && mWalFrames <= mCheckpointedFrames)
+			continue; // Timer tick, but nothing new has been written
+		lock.unlock();
+		runCheckpoint();
+		lock.lock();
+	}
+}
+
+void SqlCheckpointer::runCheckpoint() {
+	int nLog = 0, nCheckpointed = 0;
+	bool complete = false, failed = false;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	try {
+		complete = mpCheckpointDB->walCheckpoint(mPolicy.mode, &nLog, &nCheckpointed);
+	} catch (const SqlDatabaseException&) {
+		failed = true;
+	}
+	const uint64_t durationUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	if (nLog >= 0 && nCheckpointed >= 0) {
+		mCheckpointedFrames = nCheckpointed;
+		if (nCheckpointed < nLog)
+			complete = false;
+	}
+
+	void(*pHandler)(void*, const SqlCheckpointMetrics&) = 0;
+	void* pHandlerArg = 0;
+	SqlCheckpointMetrics snapshot;
+	{
+		std::lock_guard<std::mutex> lock(mMetricsMutex);
+		mMetrics.checkpoints++;
+		mMetrics.lastDurationUs = durationUs;
+		mMetrics.totalDurationUs += durationUs;
+		if (durationUs > mMetrics.maxDurationUs)
+			mMetrics.maxDurationUs = durationUs;
+		if (nLog > mMetrics.maxWalFrames)
+			mMetrics.maxWalFrames = nLog;
+		mMetrics.lastCheckpointedFrames = nCheckpointed;
+		if (failed)
+			mMetrics.errors++;
+		if (complete) {
+			mMetrics.consecutiveIncomplete = 0;
+		} else {
+			mMetrics.incomplete++;
+			mMetrics.consecutiveIncomplete++;
+			if (mPolicy.starvationThreshold > 0 && mMetrics.consecutiveIncomplete % mPolicy.starvationThreshold == 0) {
+				pHandler = mpStarvationHandler;
+				pHandlerArg = mpStarvationArg;
+			}
+		}
+		snapshot = mMetrics;
+	}
+	snapshot.walFrames = mWalFrames;
+	if (pHandler)
+		pHandler(pHandlerArg, snapshot);
+}
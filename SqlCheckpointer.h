@@ -0,0 +1,99 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// SqlCheckpointer - runs WAL checkpoints on a background thread instead of
+// inline on whichever writer happens to cross the autocheckpoint threshold.
+// Requires C++11.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef CPP_SQL_CHECKPOINTER_H
+#define CPP_SQL_CHECKPOINTER_H
+
+#include "CppSqlWrapper.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+struct SqlCheckpointPolicy {
+	SqlCheckpointMode mode = CHECKPOINT_PASSIVE;
+	// Checkpoint once this many WAL frames have not yet been checkpointed (0 = ignore WAL size)
+	int walFrameThreshold = 1000;
+	// Also checkpoint at least this often while the WAL is non-empty (0 = only use WAL size)
+	int maxIntervalMs = 0;
+	// Call the starvation handler after this many consecutive checkpoints that could not
+	// complete (usually because readers are holding old snapshots open)
+	int starvationThreshold = 5;
+};
+
+struct SqlCheckpointMetrics {
+	uint64_t checkpoints = 0;        // Number of checkpoints attempted
+	uint64_t incomplete = 0;         // ...of which could not checkpoint the whole WAL
+	uint64_t errors = 0;             // ...of which failed with an error
+	int walFrames = 0;               // WAL size in frames after the most recent commit
+	int maxWalFrames = 0;            // Largest WAL size seen
+	int lastCheckpointedFrames = 0;  // Frames checkpointed by the most recent checkpoint
+	int consecutiveIncomplete = 0;   // Current run of incomplete checkpoints
+	uint64_t lastDurationUs = 0;
+	uint64_t maxDurationUs = 0;
+	uint64_t totalDurationUs = 0;
+};
+
+class SqlCheckpointer {
+public:
+	// db must be a file database in WAL mode, in the normal (not exclusive) locking mode,
+	// so open it with useExclusiveWAL = false and set "PRAGMA journal_mode=WAL" yourself.
+	// Checkpoints run on a second connection to the same file that the checkpointer opens,
+	// so they do not hold up other users of db.
+	SqlCheckpointer(SqlDatabase& db, const SqlCheckpointPolicy& policy = SqlCheckpointPolicy());
+	~SqlCheckpointer(); // Calls stop()
+
+	// Disable inline autocheckpoints, open the checkpointing connection and start the
+	// background thread
+	void start();
+	// Stop the background thread, close its connection and restore the previous
+	// autocheckpoint setting
+	void stop();
+	bool isRunning() const { return mThread.joinable(); }
+
+	// Ask the background thread to checkpoint as soon as possible
+	void requestCheckpoint();
+
+	SqlCheckpointMetrics metrics() const;
+
+	// Called (on the background thread) each time the number of consecutive incomplete
+	// checkpoints reaches a multiple of policy.starvationThreshold.
+	void setStarvationHandler(void(*pHandler)(void*, const SqlCheckpointMetrics&), void* customArg = 0);
+
+private:
+	SqlCheckpointer(const SqlCheckpointer&);
+	SqlCheckpointer& operator=(const SqlCheckpointer&);
+
+	static int walHook(void* pArg, sqlite3* pDB, const char* szDbName, int nFrames);
+	void run();
+	void runCheckpoint();
+
+	SqlDatabase& mDB;
+	std::unique_ptr<SqlDatabase> mpCheckpointDB; // Only used by the background thread
+	const SqlCheckpointPolicy mPolicy;
+	int mPrevAutoCheckpoint;
+
+	std::thread mThread;
+	std::mutex mMutex; // Never held while calling into SQLite
+	std::condition_variable mWake;
+	bool mStopping;
+	bool mCheckpointRequested;
+
+	std::atomic<int> mWalFrames;
+	std::atomic<int> mCheckpointedFrames;
+
+	mutable std::mutex mMetricsMutex;
+	SqlCheckpointMetrics mMetrics;
+	void(*mpStarvationHandler)(void*, const SqlCheckpointMetrics&);
+	void* mpStarvationArg;
+};
+
+#endif
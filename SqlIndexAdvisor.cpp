@@ -0,0 +1,280 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#include "SqlIndexAdvisor.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <set>
+
+#include "sqlite3.h"
+
+void SqlWorkload::add(const char* szSQL, int64_t count) {
+	if (!szSQL || count <= 0)
+		return;
+	mTotal += count;
+	const std::string shape = normalize(szSQL);
+	std::map<std::string, SqlWorkloadStatement>::iterator it = mStatements.find(shape);
+	if (it == mStatements.end()) {
+		if ((int)mStatements.size() >= mMaxStatements) {
+			mDropped += count;
+			return;
+		}
+		SqlWorkloadStatement& statement = mStatements[shape];
+		statement.sql = szSQL;
+		statement.count = count;
+	} else {
+		it->second.count += count;
+	}
+}
+
+static bool IsIdentifierChar(char c) {
+	return isalnum((unsigned char)c) || c == '_' || c == '$' || (c & 0x80);
+}
+
+std::string SqlWorkload::normalize(const char* szSQL) {
+	std::string out;
+	const char* p = szSQL;
+	while (*p) {
+		const char c = *p;
+		const bool startOfToken = (p == szSQL || (!IsIdentifierChar(p[-1]) && p[-1] != '?')); // Not the 1 of ?1
+		bool literal = false;
+		if (c == '\'' || ((c == 'x' || c == 'X') && p[1] == '\'' && startOfToken)) {
+			// A string or blob literal; '' is an escaped quote
+			p += (c == '\'') ? 1 : 2;
+			while (*p && !(*p == '\'' && p[1] != '\''))
+				p += (*p == '\'') ? 2 : 1;
+			if (*p)
+				p++;
+			literal = true;
+		} else if (startOfToken && (isdigit((unsigned char)c) || (c == '.' && isdigit((unsigned char)p[1])))) {
+			// A number: 12, 1.5, .5, 1e-3 or 0x1F
+			if (c == '0' && (p[1] == 'x' || p[1] == 'X'))
+				p += 2;
+			while (IsIdentifierChar(*p) || *p == '.' ||
+				((*p == '+' || *p == '-') && (p[-1] == 'e' || p[-1] == 'E')))
+				p++;
+			literal = true;
+		} else if (c == '"' || c == '`' || c == '[') {
+			// A quoted identifier, which is kept
+			const char close = (c == '[') ? ']' : c;
+			const char* start = p++;
+			while (*p && *p != close)
+				p++;
+			if (*p)
+				p++;
+			out.append(start, p - start);
+			continue;
+		} else if (isspace((unsigned char)c)) {
+			while (isspace((unsigned char)*p))
+				p++;
+			if (!out.empty() && *p)
+				out += ' ';
+			continue;
+		}
+		if (!literal) {
+			out += c;
+			p++;
+			continue;
+		}
+		// Collapse "?, ?" (and "?,?") to "?"
+		size_t end = out.size();
+		if (end && out[end - 1] == ' ')
+			end--;
+		if (end >= 2 && out[end - 1] == ',' && (out[end - 2] == '?' || (end >= 3 && out[end - 2] == ' ' && out[end - 3] == '?')))
+			out.erase(out[end - 2] == '?' ? end - 1 : end - 2);
+		else
+			out += '?';
+	}
+	return out;
+}
+
+void SqlWorkload::save(std::ostream& out) const {
+	// "<count> <length>\n<SQL>\n" per statement shape, since SQL may contain newlines
+	for (std::map<std::string, SqlWorkloadStatement>::const_iterator it = mStatements.begin(); it != mStatements.end(); ++it)
+		out << it->second.count << ' ' << it->second.sql.size() << '\n' << it->second.sql << '\n';
+}
+
+bool SqlWorkload::load(std::istream& in) {
+	int64_t count;
+	size_t nLen;
+	while (in >> count >> nLen) {
+		if (in.get() != '\n')
+			return false;
+		std::string sql(nLen, '\0');
+		if (nLen && !in.read(&sql[0], (std::streamsize)nLen))
+			return false;
+		if (in.get() != '\n')
+			return false;
+		add(sql.c_str(), count);
+	}
+	return in.eof();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+typedef std::pair<std::string, std::string> TableColumn;
+
+struct Replay {
+	const std::string* pSQL;
+	int64_t count;
+	int64_t fullScanSteps; // Per execution, without any candidate index
+	int64_t vmSteps;
+	std::set<TableColumn> columns; // Columns read
+	std::set<std::string> writes;  // Tables inserted into, updated or deleted from
+};
+
+int collectTableAccess(void* pArg, int action, const char* szTable, const char* szColumn, const char*, const char*) {
+	if (!szTable || strncmp(szTable, "sqlite_", 7) == 0)
+		return SQLITE_OK;
+	Replay* pReplay = static_cast<Replay*>(pArg);
+	if (action == SQLITE_READ && szColumn && *szColumn)
+		pReplay->columns.insert(TableColumn(szTable, szColumn));
+	else if (action == SQLITE_INSERT || action == SQLITE_UPDATE || action == SQLITE_DELETE)
+		pReplay->writes.insert(szTable);
+	return SQLITE_OK;
+}
+
+// Only statements that read or write table rows are worth replaying
+bool isReplayable(const std::string& sql) {
+	size_t i = 0;
+	while (i < sql.size() && (isspace((unsigned char)sql[i]) || sql[i] == '('))
+		i++;
+	std::string keyword;
+	for (; i < sql.size() && isalpha((unsigned char)sql[i]); i++)
+		keyword += (char)toupper((unsigned char)sql[i]);
+	return keyword == "SELECT" || keyword == "WITH" || keyword == "INSERT" || keyword == "REPLACE" ||
+		keyword == "UPDATE" || keyword == "DELETE" || keyword == "VALUES";
+}
+
+bool byVmStepsSaved(const SqlIndexRecommendation& a, const SqlIndexRecommendation& b) {
+	return (a.vmStepsBefore - a.vmStepsAfter) > (b.vmStepsBefore - b.vmStepsAfter);
+}
+}
+
+SqlIndexAdvisor::SqlIndexAdvisor(const char* szDatabaseFile, const char* szScratchFile)
+	: mScratch(szScratchFile, false), mnSkipped(0)
+{
+	sqlite3* pSource = 0;
+	if (sqlite3_open_v2(szDatabaseFile, &pSource, SQLITE_OPEN_READONLY, 0) != SQLITE_OK) {
+		sqlite3_close(pSource);
+		throw SqlDatabaseException("Unable to open database file.");
+	}
+	sqlite3_backup* pBackup = sqlite3_backup_init(mScratch.handle(), "main", pSource, "main");
+	int result = pBackup ? sqlite3_backup_step(pBackup, -1) : SQLITE_ERROR;
+	if (pBackup)
+		sqlite3_backup_finish(pBackup);
+	sqlite3_close(pSource);
+	if (result != SQLITE_DONE)
+		throw SqlDatabaseException("Unable to copy the database for analysis.");
+}
+
+bool SqlIndexAdvisor::measure(const std::string& szSQL, int maxStatementMs, Cost& rCost) {
+	mScratch.sqlExecute("SAVEPOINT index_advisor");
+	bool ok = true;
+	try {
+		SqlStatement statement = mScratch.sqlCompile(szSQL);
+		if (statement.numParams() > 0) {
+			ok = false;
+		} else {
+			statement.setTimeout(maxStatementMs);
+			for (statement.execute(); statement.hasRow(); statement.nextRow()) {}
+			const SqlStatementStats stats = statement.stats();
+			rCost.fullScanSteps = stats.fullScanSteps;
+			rCost.vmSteps = stats.vmSteps;
+		}
+	} catch (const SqlDatabaseException&) {
+		ok = false;
+	}
+	mScratch.sqlExecute("ROLLBACK TO index_advisor; RELEASE index_advisor");
+	return ok;
+}
+
+std::vector<SqlIndexRecommendation> SqlIndexAdvisor::analyze(const SqlWorkload& workload, int maxStatementMs) {
+	mnSkipped = 0;
+	// Measure each statement as the database is, and note the columns it reads and the
+	// tables it writes
+	std::vector<Replay> replays;
+	std::map<TableColumn, std::vector<size_t> > candidates; // Statements with full scans that read each column
+	std::map<std::string, std::vector<size_t> > writers;    // Statements that write each table
+	const std::map<std::string, SqlWorkloadStatement>& statements = workload.statements();
+	for (std::map<std::string, SqlWorkloadStatement>::const_iterator it = statements.begin(); it != statements.end(); ++it) {
+		Cost cost;
+		if (!isReplayable(it->second.sql) || !measure(it->second.sql, maxStatementMs, cost)) {
+			mnSkipped++;
+			continue;
+		}
+		replays.push_back(Replay());
+		Replay& replay = replays.back();
+		replay.pSQL = &it->second.sql;
+		replay.count = it->second.count;
+		replay.fullScanSteps = cost.fullScanSteps;
+		replay.vmSteps = cost.vmSteps;
+		sqlite3_set_authorizer(mScratch.handle(), &collectTableAccess, &replay);
+		try {
+			mScratch.sqlCompile(replay.pSQL->c_str());
+		} catch (const SqlDatabaseException&) {}
+		sqlite3_set_authorizer(mScratch.handle(), 0, 0);
+		if (replay.fullScanSteps > 0) {
+			for (std::set<TableColumn>::const_iterator col = replay.columns.begin(); col != replay.columns.end(); ++col)
+				candidates[*col].push_back(replays.size() - 1);
+		}
+		for (std::set<std::string>::const_iterator table = replay.writes.begin(); table != replay.writes.end(); ++table)
+			writers[*table].push_back(replays.size() - 1);
+	}
+
+	// Try each candidate index on its own, against the statements that read its column and
+	// those that write its table (which pay to keep the index up to date)
+	std::vector<SqlIndexRecommendation> recommendations;
+	for (std::map<TableColumn, std::vector<size_t> >::const_iterator it = candidates.begin(); it != candidates.end(); ++it) {
+		const std::string& table = it->first.first;
+		const std::string& column = it->first.second;
+		std::set<size_t> affected(it->second.begin(), it->second.end());
+		std::map<std::string, std::vector<size_t> >::const_iterator tableWriters = writers.find(table);
+		if (tableWriters != writers.end())
+			affected.insert(tableWriters->second.begin(), tableWriters->second.end());
+		try {
+			mScratch.sqlExecute(mScratch.sqlFormat("CREATE INDEX index_advisor_candidate ON \"%w\"(\"%w\")",
+				table.c_str(), column.c_str()).c_str());
+		} catch (const SqlDatabaseException&) {
+			continue; // e.g. a view, or a virtual table
+		}
+		SqlIndexRecommendation rec;
+		rec.table = table;
+		rec.column = column;
+		rec.statements = rec.slowedStatements = 0;
+		rec.executions = rec.slowedExecutions = 0;
+		rec.fullScanStepsBefore = rec.fullScanStepsAfter = rec.vmStepsBefore = rec.vmStepsAfter = 0;
+		for (std::set<size_t>::const_iterator i = affected.begin(); i != affected.end(); ++i) {
+			const Replay& replay = replays[*i];
+			Cost cost;
+			if (!measure(*replay.pSQL, maxStatementMs, cost) || cost.vmSteps == replay.vmSteps)
+				continue;
+			if (cost.vmSteps < replay.vmSteps) {
+				rec.statements++;
+				rec.executions += replay.count;
+			} else {
+				rec.slowedStatements++;
+				rec.slowedExecutions += replay.count;
+			}
+			rec.fullScanStepsBefore += replay.fullScanSteps * replay.count;
+			rec.fullScanStepsAfter += cost.fullScanSteps * replay.count;
+			rec.vmStepsBefore += replay.vmSteps * replay.count;
+			rec.vmStepsAfter += cost.vmSteps * replay.count;
+		}
+		mScratch.sqlExecute("DROP INDEX index_advisor_candidate");
+		if (rec.statements > 0 && rec.vmStepsAfter < rec.vmStepsBefore) {
+			rec.createSQL = mScratch.sqlFormat("CREATE INDEX \"%w\" ON \"%w\"(\"%w\")",
+				("idx_" + table + "_" + column).c_str(), table.c_str(), column.c_str());
+			recommendations.push_back(rec);
+		}
+	}
+	std::stable_sort(recommendations.begin(), recommendations.end(), byVmStepsSaved);
+	return recommendations;
+}
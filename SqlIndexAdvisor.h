@@ -0,0 +1,112 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// SqlIndexAdvisor - recommends indexes for a recorded workload. The workload's
+// SQL (captured with SqlDatabase::setSqlTraceHandler()) is replayed against a
+// private copy of the database, first as it is and then with each candidate
+// index in turn; an index is recommended if it cuts the work SQLite does.
+//
+// Candidates are single-column indexes on the columns read by statements that
+// do full table scans. Each is measured on its own, so two recommendations for
+// the same statement may overlap. The statements that write to the table are
+// measured too, so the cost of maintaining an index is set against its gains.
+// Every statement is replayed inside a savepoint that is rolled back, so writes
+// in the workload change nothing.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef CPP_SQL_INDEX_ADVISOR_H
+#define CPP_SQL_INDEX_ADVISOR_H
+
+#include "CppSqlWrapper.h"
+
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
+struct SqlWorkloadStatement {
+	std::string sql; // The first statement of this shape that was seen, literals and all
+	int64_t count;   // How many statements of this shape were run
+};
+
+// The distinct SQL statements run by an application, with how often each was run.
+// Statements that differ only in their literal values are counted as one: the traced
+// SQL has the bound parameter values written into it, and counting each value
+// separately would give every statement a count of about 1 and grow without bound.
+class SqlWorkload {
+public:
+	// At most maxStatements distinct statement shapes are kept; statements of any other
+	// shape after that are only counted by numDropped()
+	explicit SqlWorkload(int maxStatements = 10000) : mMaxStatements(maxStatements), mTotal(0), mDropped(0) {}
+
+	void add(const char* szSQL, int64_t count = 1);
+	// For use with SqlDatabase::setSqlTraceHandler(&SqlWorkload::traceHandler, &workload)
+	static void traceHandler(void* pWorkload, const char* szSQL) { static_cast<SqlWorkload*>(pWorkload)->add(szSQL); }
+
+	// Keyed by the statement's shape: normalize()d SQL
+	const std::map<std::string, SqlWorkloadStatement>& statements() const { return mStatements; }
+	int64_t totalExecutions() const { return mTotal; }
+	int64_t numDropped() const { return mDropped; }
+	void clear() { mStatements.clear(); mTotal = mDropped = 0; }
+
+	// Replace each string, number and blob literal with ?, collapse lists of them such as
+	// "IN (1, 2, 3)" to a single ?, and collapse runs of white space
+	static std::string normalize(const char* szSQL);
+
+	// Save to / load from a file, so a workload recorded in production can be analyzed
+	// offline. load() adds to any statements already in the workload, and returns false
+	// if the data is not in the format written by save().
+	void save(std::ostream& out) const;
+	bool load(std::istream& in);
+private:
+	std::map<std::string, SqlWorkloadStatement> mStatements;
+	int mMaxStatements;
+	int64_t mTotal;
+	int64_t mDropped;
+};
+
+struct SqlIndexRecommendation {
+	std::string table;
+	std::string column;
+	std::string createSQL;   // A CREATE INDEX statement for the index
+	int statements;          // Distinct statements in the workload that it speeds up
+	int64_t executions;      // How many times those statements were run
+	int slowedStatements;    // Distinct statements it slows down, e.g. inserts that must update it
+	int64_t slowedExecutions;
+	// Totals over the executions of all those statements, without and with the index:
+	int64_t fullScanStepsBefore, fullScanStepsAfter;
+	int64_t vmStepsBefore, vmStepsAfter;
+
+	// Estimated net fraction of the work for those statements that the index saves
+	double benefit() const { return vmStepsBefore > 0 ? double(vmStepsBefore - vmStepsAfter) / double(vmStepsBefore) : 0.0; }
+};
+
+class SqlIndexAdvisor {
+public:
+	// Copy szDatabaseFile (which is opened read-only) into szScratchFile, which must not be
+	// the same file; by default the copy is held in memory.
+	explicit SqlIndexAdvisor(const char* szDatabaseFile, const char* szScratchFile = ":memory:");
+
+	// Replay the workload and return the indexes worth creating, most useful first.
+	// Statements that take longer than maxStatementMs are abandoned, as are statements
+	// that fail or still contain parameters.
+	std::vector<SqlIndexRecommendation> analyze(const SqlWorkload& workload, int maxStatementMs = 10000);
+	// Distinct statements skipped by the last analyze(): not DML or SELECT, or could not be run
+	int numSkipped() const { return mnSkipped; }
+
+private:
+	SqlIndexAdvisor(const SqlIndexAdvisor&);
+	SqlIndexAdvisor& operator=(const SqlIndexAdvisor&);
+
+	struct Cost {
+		int64_t fullScanSteps;
+		int64_t vmSteps;
+	};
+	bool measure(const std::string& szSQL, int maxStatementMs, Cost& rCost);
+
+	SqlDatabase mScratch;
+	int mnSkipped;
+};
+
+#endif
@@ -0,0 +1,90 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#include "SqlPrefetchCursor.h"
+
+SqlPrefetchCursor::SqlPrefetchCursor(SqlStatement& rStatement, const SqlPrefetchOptions& options)
+	: mStatement(rStatement), mBatchRows(options.batchRows > 0 ? options.batchRows : 1),
+	  mBatches(options.numBatches > 2 ? options.numBatches : 2),
+	  mpCurrent(0), mStopping(false), mFinished(false)
+{
+	for (size_t i = 0; i < mBatches.size(); i++)
+		mFree.push_back(&mBatches[i]);
+	mThread = std::thread(&SqlPrefetchCursor::run, this);
+}
+
+SqlPrefetchCursor::~SqlPrefetchCursor() {
+	cancel();
+	mThread.join();
+}
+
+void SqlPrefetchCursor::cancel() {
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mFreed.notify_one();
+}
+
+const SqlResultSet* SqlPrefetchCursor::nextBatch() {
+	std::unique_lock<std::mutex> lock(mMutex);
+	if (mpCurrent) {
+		mFree.push_back(mpCurrent);
+		mpCurrent = 0;
+		mFreed.notify_one();
+	}
+	mFilled.wait(lock, [this]() { return !mReady.empty() || mFinished; });
+	if (!mReady.empty() && !mStopping) {
+		mpCurrent = mReady.front();
+		mReady.pop_front();
+		return mpCurrent;
+	}
+	if (mError) {
+		std::exception_ptr error = mError;
+		mError = nullptr;
+		std::rethrow_exception(error);
+	}
+	return 0;
+}
+
+void SqlPrefetchCursor::run() {
+	SqlResultSet* pBatch = 0;
+	try {
+		mStatement.execute();
+		while (mStatement.hasRow()) {
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				mFreed.wait(lock, [this]() { return !mFree.empty() || mStopping; });
+				if (mStopping)
+					break;
+				pBatch = mFree.front();
+				mFree.pop_front();
+			}
+			// Filled without holding the lock, while the consumer works on another batch
+			pBatch->clear();
+			pBatch->appendRows(mStatement, mBatchRows);
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mReady.push_back(pBatch);
+				pBatch = 0;
+			}
+			mFilled.notify_one();
+		}
+	} catch (...) {
+		std::lock_guard<std::mutex> lock(mMutex);
+		// The rows appended to the batch before the error are returned ahead of it
+		if (pBatch && pBatch->numRows() > 0)
+			mReady.push_back(pBatch);
+		else if (pBatch)
+			mFree.push_back(pBatch);
+		mError = std::current_exception();
+	}
+	mStatement.reset(); // Release the read transaction as soon as possible
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mFinished = true;
+	}
+	mFilled.notify_one();
+}
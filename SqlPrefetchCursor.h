@@ -0,0 +1,69 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// SqlPrefetchCursor - steps a statement on a background thread, copying its
+// rows into a small ring of SqlResultSet batches, so that the caller can work
+// on one batch while SQLite reads the next.
+// Requires C++11.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef CPP_SQL_PREFETCH_CURSOR_H
+#define CPP_SQL_PREFETCH_CURSOR_H
+
+#include "CppSqlWrapper.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct SqlPrefetchOptions {
+	// Rows per batch
+	int batchRows = 1024;
+	// Batches in the ring: one being read by the caller, the rest filled ahead of it
+	int numBatches = 3;
+};
+
+class SqlPrefetchCursor {
+public:
+	// Starts running rStatement (with whatever parameters are bound to it) on a background
+	// thread. Until this cursor is destroyed, do not use the statement, nor its database
+	// from any other thread; to keep querying meanwhile, use a second connection.
+	SqlPrefetchCursor(SqlStatement& rStatement, const SqlPrefetchOptions& options = SqlPrefetchOptions());
+	// Stops the background thread and resets the statement
+	~SqlPrefetchCursor();
+
+	// Wait for the next batch of rows. Returns NULL once all the rows have been returned.
+	// The batch is only valid until the next call. An exception thrown while reading
+	// (e.g. a timeout) is rethrown here, after the rows read before it.
+	const SqlResultSet* nextBatch();
+	// Stop reading ahead; nextBatch() then returns NULL
+	void cancel();
+
+private:
+	SqlPrefetchCursor(const SqlPrefetchCursor&);
+	SqlPrefetchCursor& operator=(const SqlPrefetchCursor&);
+
+	void run();
+
+	SqlStatement& mStatement;
+	const int mBatchRows;
+	std::vector<SqlResultSet> mBatches;
+
+	std::mutex mMutex;
+	std::condition_variable mFreed;  // The producer waits on this for an empty batch
+	std::condition_variable mFilled; // The consumer waits on this for a full batch
+	std::deque<SqlResultSet*> mFree;
+	std::deque<SqlResultSet*> mReady;
+	SqlResultSet* mpCurrent; // Returned by the last nextBatch()
+	bool mStopping;
+	bool mFinished; // The producer has read its last row
+	std::exception_ptr mError;
+
+	std::thread mThread;
+};
+
+#endif
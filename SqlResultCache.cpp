@@ -0,0 +1,279 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#include "SqlResultCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "sqlite3.h"
+
+// Rough per-entry bookkeeping overhead (map node, LRU node, table index), counted
+// towards maxBytes so that many tiny results cannot grow the cache without bound.
+static const size_t kEntryOverhead = 128;
+
+// Find the tables that szSQL reads from its bytecode: each OpenRead opens a table or
+// index b-tree by its root page, which the schema maps back to the table. (This
+// leaves the connection's authorizer alone, which the application may be using.)
+// Returns false if the statement reads a virtual table or a WITHOUT ROWID table,
+// which the update hook does not report changes to, so its results must not be cached.
+static bool collectReadTables(SqlDatabase& db, const std::string& szSQL, std::vector<std::string>& tables) {
+	std::set<std::pair<int, int> > roots; // (database index, root page)
+	{
+		SqlStatement explain = db.sqlCompile("EXPLAIN " + szSQL);
+		for (explain.execute(); explain.hasRow(); explain.nextRow()) {
+			const char* szOpcode = explain.currentRow().getStringField(1);
+			if (strcmp(szOpcode, "VOpen") == 0)
+				return false;
+			if (strcmp(szOpcode, "OpenRead") == 0)
+				roots.insert(std::make_pair(explain.currentRow().getIntField(4), explain.currentRow().getIntField(3)));
+		}
+	}
+	if (roots.empty())
+		return true;
+	std::map<int, std::string> databases;
+	{
+		SqlStatement list = db.sqlCompile("PRAGMA database_list");
+		for (list.execute(); list.hasRow(); list.nextRow())
+			databases[list.currentRow().getIntField(0)] = list.currentRow().getStringField(1);
+	}
+	for (std::set<std::pair<int, int> >::const_iterator it = roots.begin(); it != roots.end(); ++it) {
+		std::map<int, std::string>::const_iterator database = databases.find(it->first);
+		if (database == databases.end())
+			continue;
+		// The test for WITHOUT ROWID errs on the side of not caching
+		SqlStatement lookup = db.sqlCompile(db.sqlFormat(
+			"SELECT s.tbl_name, (SELECT t.sql LIKE '%%WITHOUT%%ROWID%%' FROM \"%w\".sqlite_master t"
+			" WHERE t.type = 'table' AND t.name = s.tbl_name) FROM \"%w\".sqlite_master s WHERE s.rootpage = %d",
+			database->second.c_str(), database->second.c_str(), it->second));
+		for (lookup.execute(); lookup.hasRow(); lookup.nextRow()) {
+			if (lookup.currentRow().getIntField(1))
+				return false;
+			const std::string table = lookup.currentRow().getStringField(0);
+			if (std::find(tables.begin(), tables.end(), table) == tables.end())
+				tables.push_back(table);
+		}
+	}
+	return true;
+}
+
+static void appendKeyBytes(std::string& key, const void* pData, size_t nLen) {
+	key.append((const char*)pData, nLen);
+}
+
+SqlResultCache::SqlResultCache(SqlDatabase& db, size_t maxBytes, size_t maxStatements)
+	: mDB(db), mMaxBytes(maxBytes), mMaxStatements(maxStatements > 0 ? maxStatements : 1), mChangeHandlerId(0), mDataVersion(-1), mSchemaVersion(-1)
+{
+	memset(&mStats, 0, sizeof(mStats));
+	mChangeHandlerId = mDB.onChange(0, &SqlResultCache::onTableChanged, this);
+}
+
+SqlResultCache::~SqlResultCache() {
+	try {
+		destroy();
+	} catch (...) {} // Destructors must not propagate exceptions
+}
+
+void SqlResultCache::destroy() {
+	if (mChangeHandlerId) {
+		mDB.removeChangeHandler(mChangeHandlerId);
+		mChangeHandlerId = 0;
+	}
+	clear();
+	mStatements.clear();
+	mStatementLru.clear();
+	mVersionQuery.destroy();
+	mDataVersion = mSchemaVersion = -1;
+	mUncached.clear();
+}
+
+void SqlResultCache::onTableChanged(void* pArg, const char* szTable) {
+	SqlResultCache* self = static_cast<SqlResultCache*>(pArg);
+	if (szTable) {
+		self->invalidateTable(szTable);
+	} else {
+		// Rows changed in tables SQLite did not name
+		self->mStats.invalidations += self->mEntries.size();
+		self->clear();
+	}
+}
+
+SqlResultCache::CachedStatement& SqlResultCache::compile(const std::string& szSQL) {
+	std::map<std::string, CachedStatement>::iterator it = mStatements.find(szSQL);
+	if (it != mStatements.end()) {
+		mStatementLru.splice(mStatementLru.begin(), mStatementLru, it->second.lruPosition);
+		return it->second;
+	}
+	while (mStatements.size() >= mMaxStatements)
+		removeStatement(mStatements.find(mStatementLru.back()));
+
+	CachedStatement& cs = mStatements[szSQL];
+	try {
+		cs.statement = mDB.sqlCompile(szSQL, PREPARE_PERSISTENT);
+		cs.cacheable = cs.statement.isReadOnly() && collectReadTables(mDB, szSQL, cs.tables);
+	} catch (...) {
+		mStatements.erase(szSQL);
+		throw;
+	}
+	mStatementLru.push_front(szSQL);
+	cs.lruPosition = mStatementLru.begin();
+	return cs;
+}
+
+void SqlResultCache::removeStatement(std::map<std::string, CachedStatement>::iterator it) {
+	// Cached results refer to the statement's table list, so drop them too. Their keys all
+	// start with the SQL and a NUL, so they are next to each other in mEntries.
+	const std::string prefix = it->first + '\0';
+	EntryMap::iterator entry = mEntries.lower_bound(prefix);
+	while (entry != mEntries.end() && entry->first.compare(0, prefix.size(), prefix) == 0) {
+		EntryMap::iterator next = entry;
+		++next;
+		removeEntry(entry);
+		mStats.evictions++;
+		entry = next;
+	}
+	mStatementLru.erase(it->second.lruPosition);
+	mStatements.erase(it);
+}
+
+void SqlResultCache::run(CachedStatement& rStatement, const std::vector<SqlValue>& params, SqlResultSet& result) {
+	SqlStatement& stmt = rStatement.statement;
+	if ((int)params.size() != stmt.numParams()) {
+		// Otherwise parameters left out would keep their values from the previous query
+		std::ostringstream msg;
+		msg << "SqlResultCache::query() was given " << params.size() << " parameters for a statement with " << stmt.numParams() << ".";
+		throw SqlDatabaseException(msg.str());
+	}
+	for (size_t i = 0; i < params.size(); i++)
+		stmt.bind(params[i]);
+	stmt.execute();
+	result.clear();
+	result.appendRows(stmt); // Reads to the end, which also releases the read lock
+}
+
+void SqlResultCache::checkExternalChanges() {
+	if (mDataVersion < 0)
+		mVersionQuery = mDB.sqlCompile("SELECT data_version, schema_version FROM pragma_data_version, pragma_schema_version",
+			PREPARE_PERSISTENT);
+	mVersionQuery.execute();
+	const int64_t dataVersion = mVersionQuery.currentRow().getInt64Field(0);
+	const int64_t schemaVersion = mVersionQuery.currentRow().getInt64Field(1);
+	mVersionQuery.nextRow(); // Finish the statement so it does not hold a read transaction open
+	if (dataVersion != mDataVersion || schemaVersion != mSchemaVersion) {
+		if (mDataVersion >= 0)
+			mStats.invalidations += mEntries.size();
+		clear();
+		mDataVersion = dataVersion;
+		mSchemaVersion = schemaVersion;
+	}
+}
+
+const SqlResultSet& SqlResultCache::query(const std::string& szSQL, const SqlValue& param1) {
+	return query(szSQL, std::vector<SqlValue>(1, param1));
+}
+
+const SqlResultSet& SqlResultCache::query(const std::string& szSQL, const SqlValue& param1, const SqlValue& param2) {
+	std::vector<SqlValue> params(1, param1);
+	params.push_back(param2);
+	return query(szSQL, params);
+}
+
+const SqlResultSet& SqlResultCache::query(const std::string& szSQL, const std::vector<SqlValue>& params) {
+	CachedStatement& cs = compile(szSQL);
+	if (!cs.cacheable || mDB.inTransaction()) {
+		mStats.bypassed++;
+		run(cs, params, mUncached);
+		return mUncached;
+	}
+	checkExternalChanges();
+
+	std::string key(szSQL);
+	key.push_back('\0');
+	for (size_t i = 0; i < params.size(); i++) {
+		const SqlValue& v = params[i];
+		key.push_back((char)v.type());
+		if (v.type() == SQLITE_INTEGER) {
+			const int64_t n = v.asInt64();
+			appendKeyBytes(key, &n, sizeof(n));
+		} else if (v.type() == SQLITE_FLOAT) {
+			const double d = v.asFloat();
+			appendKeyBytes(key, &d, sizeof(d));
+		} else if (v.type() != SQLITE_NULL) {
+			const uint32_t nLen = (uint32_t)v.asString().size();
+			appendKeyBytes(key, &nLen, sizeof(nLen));
+			key.append(v.asString());
+		}
+	}
+
+	EntryMap::iterator it = mEntries.find(key);
+	if (it != mEntries.end()) {
+		mStats.hits++;
+		mLru.splice(mLru.begin(), mLru, it->second.lruPosition);
+		return it->second.result;
+	}
+
+	mStats.misses++;
+	SqlResultSet result;
+	run(cs, params, result);
+	const size_t nBytes = result.memoryUsed() + 2 * key.size() + kEntryOverhead;
+	if (nBytes > mMaxBytes) {
+		mStats.bypassed++;
+		mUncached.swap(result);
+		return mUncached;
+	}
+	while (mStats.bytes + nBytes > mMaxBytes && !mLru.empty()) {
+		removeEntry(mEntries.find(mLru.back()));
+		mStats.evictions++;
+	}
+
+	Entry& entry = mEntries[key];
+	entry.result.swap(result);
+	entry.bytes = nBytes;
+	entry.pTables = &cs.tables;
+	mLru.push_front(key);
+	entry.lruPosition = mLru.begin();
+	for (size_t i = 0; i < cs.tables.size(); i++)
+		mKeysByTable[cs.tables[i]].insert(key);
+	mStats.bytes += nBytes;
+	mStats.entries = mEntries.size();
+	return entry.result;
+}
+
+void SqlResultCache::removeEntry(EntryMap::iterator it) {
+	const std::vector<std::string>& tables = *it->second.pTables;
+	for (size_t i = 0; i < tables.size(); i++)
+		mKeysByTable[tables[i]].erase(it->first);
+	mLru.erase(it->second.lruPosition);
+	mStats.bytes -= it->second.bytes;
+	mEntries.erase(it);
+	mStats.entries = mEntries.size();
+}
+
+void SqlResultCache::invalidateTable(const char* szTable) {
+	std::map<std::string, std::set<std::string> >::iterator tableIt = mKeysByTable.find(szTable);
+	if (tableIt == mKeysByTable.end())
+		return;
+	const std::set<std::string> keys(tableIt->second);
+	for (std::set<std::string>::const_iterator key = keys.begin(); key != keys.end(); ++key) {
+		EntryMap::iterator it = mEntries.find(*key);
+		if (it != mEntries.end()) {
+			removeEntry(it);
+			mStats.invalidations++;
+		}
+	}
+}
+
+void SqlResultCache::clear() {
+	mEntries.clear();
+	mLru.clear();
+	mKeysByTable.clear();
+	mStats.bytes = 0;
+	mStats.entries = 0;
+}
+
+SqlResultCacheStats SqlResultCache::stats() const {
+	return mStats;
+}
@@ -0,0 +1,111 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// SqlResultCache - an opt-in cache of query results, keyed by SQL text plus the
+// bound parameter values, for repeated identical reads of rarely changing tables.
+//
+// Entries are invalidated:
+//  - per table, when a transaction on this connection that changed one of the
+//    tables the query reads commits (via SqlDatabase::onChange());
+//  - all at once, when "PRAGMA data_version" or "PRAGMA schema_version" show that
+//    another connection has committed changes, or the schema has changed.
+// The cache is bypassed inside explicit transactions, where the connection may see
+// its own uncommitted changes. Only cache deterministic, read-only queries: a query
+// calling e.g. random() or datetime('now') will keep returning its first result.
+// Queries on virtual tables and WITHOUT ROWID tables are never cached, as SQLite's
+// update hook does not report changes to them.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef CPP_SQL_RESULT_CACHE_H
+#define CPP_SQL_RESULT_CACHE_H
+
+#include "CppSqlWrapper.h"
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+struct SqlResultCacheStats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t bypassed;      // Queries run directly (in a transaction, not read-only, or too large)
+	uint64_t evictions;     // Entries removed to stay within maxBytes or maxStatements
+	uint64_t invalidations; // Entries removed because their tables changed
+	size_t entries;
+	size_t bytes;
+
+	double hitRate() const { return (hits + misses) ? double(hits) / double(hits + misses) : 0.0; }
+};
+
+class SqlResultCache {
+public:
+	// maxBytes: the approximate total size of all cached results
+	// maxStatements: how many compiled statements to keep; the least recently used one
+	// (and its cached results) is dropped to make room for another
+	SqlResultCache(SqlDatabase& db, size_t maxBytes = 16 * 1024 * 1024, size_t maxStatements = 256);
+	~SqlResultCache(); // Calls destroy()
+
+	// Run szSQL with the given parameters bound in order (one for each parameter), or return the result of an
+	// identical earlier query if nothing it depends on has changed since.
+	// The returned result is only valid until the next call to a method of this cache.
+	const SqlResultSet& query(const std::string& szSQL, const std::vector<SqlValue>& params = std::vector<SqlValue>());
+	const SqlResultSet& query(const std::string& szSQL, const SqlValue& param1);
+	const SqlResultSet& query(const std::string& szSQL, const SqlValue& param1, const SqlValue& param2);
+
+	// Drop cached results that read from szTable
+	void invalidateTable(const char* szTable);
+	// Drop all cached results
+	void clear();
+
+	SqlResultCacheStats stats() const;
+
+	// Free all cached results and compiled statements. Must be called before the database
+	// is closed, if the cache outlives it.
+	void destroy();
+
+private:
+	SqlResultCache(const SqlResultCache&);
+	SqlResultCache& operator=(const SqlResultCache&);
+
+	struct CachedStatement {
+		SqlStatement statement;
+		bool cacheable; // Read-only, so its results may be cached
+		std::vector<std::string> tables; // The tables it reads from
+		std::list<std::string>::iterator lruPosition;
+	};
+	struct Entry {
+		SqlResultSet result;
+		size_t bytes;
+		const std::vector<std::string>* pTables;
+		std::list<std::string>::iterator lruPosition;
+	};
+	typedef std::map<std::string, Entry> EntryMap;
+
+	static void onTableChanged(void* pArg, const char* szTable);
+	CachedStatement& compile(const std::string& szSQL);
+	static void run(CachedStatement& rStatement, const std::vector<SqlValue>& params, SqlResultSet& result);
+	void checkExternalChanges();
+	void removeEntry(EntryMap::iterator it);
+	void removeStatement(std::map<std::string, CachedStatement>::iterator it);
+
+	SqlDatabase& mDB;
+	const size_t mMaxBytes;
+	const size_t mMaxStatements;
+	int mChangeHandlerId;
+
+	std::map<std::string, CachedStatement> mStatements;
+	std::list<std::string> mStatementLru; // Keys of mStatements, most recently used first
+	EntryMap mEntries;
+	std::list<std::string> mLru; // Keys of mEntries, most recently used first
+	std::map<std::string, std::set<std::string> > mKeysByTable;
+	SqlResultSet mUncached; // Result of the last query that bypassed the cache
+
+	SqlStatement mVersionQuery;
+	int64_t mDataVersion, mSchemaVersion;
+	SqlResultCacheStats mStats;
+};
+
+#endif
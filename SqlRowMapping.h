@@ -0,0 +1,184 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// SqlRowMapping - describe a struct's fields once, then bind it to and decode it
+// from SQL statements without any per-field code or by-name lookups.
+//
+// Usage (at global scope):
+//     struct User { int64_t id; std::string name; double score; };
+//     SQL_ROW_MAPPING_BEGIN(User, "users")
+//         SQL_ROW_FIELD(id)
+//         SQL_ROW_FIELD(name)
+//         SQL_ROW_FIELD_NAMED(score, "user_score")
+//     SQL_ROW_MAPPING_END()
+//
+//     SqlStatement ins = db.sqlCompile(SqlRowMapper<User>::insertSql());
+//     SqlRowMapper<User>::bindRow(ins, user).execute();
+//
+//     SqlStatement sel = db.sqlQuery(SqlRowMapper<User>::selectSql().c_str());
+//     for (; sel.hasRow(); sel.nextRow())
+//         SqlRowMapper<User>::readRow(sel.currentRow(), user);
+//
+// Supported member types: int, int64_t, double, bool, std::string.
+// The table and column names are quoted as identifiers in the generated SQL, so give
+// them unquoted and without a schema prefix.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef CPP_SQL_ROW_MAPPING_H
+#define CPP_SQL_ROW_MAPPING_H
+
+#include "CppSqlWrapper.h"
+
+#include <string>
+#include <vector>
+
+// Specialized for each mapped struct by the SQL_ROW_MAPPING_* macros below
+template<typename T> struct SqlRowTraits;
+
+#define SQL_ROW_MAPPING_BEGIN(Type, szTable) \
+	template<> struct SqlRowTraits<Type> { \
+		typedef Type RowType; \
+		static const char* tableName() { return szTable; } \
+		template<typename Visitor> static void visitFields(Visitor& v) {
+#define SQL_ROW_FIELD(member) v.field(#member, &RowType::member);
+#define SQL_ROW_FIELD_NAMED(member, szColumn) v.field(szColumn, &RowType::member);
+#define SQL_ROW_MAPPING_END() } };
+
+namespace SqlRowMappingDetail {
+	inline void bindValue(SqlStatement& s, int v) { s.bind(v); }
+	inline void bindValue(SqlStatement& s, int64_t v) { s.bind(v); }
+	inline void bindValue(SqlStatement& s, double v) { s.bind(v); }
+	inline void bindValue(SqlStatement& s, bool v) { s.bind(v ? 1 : 0); }
+	inline void bindValue(SqlStatement& s, const std::string& v) { s.bind(v.c_str()); }
+
+	// The column index has already been validated by the caller. NULL reads as 0 / "".
+	inline void readValue(const SqlStatement::ResultRow& r, int n, int& v) { v = r.getIntUnchecked(n); }
+	inline void readValue(const SqlStatement::ResultRow& r, int n, int64_t& v) { v = r.getInt64Unchecked(n); }
+	inline void readValue(const SqlStatement::ResultRow& r, int n, double& v) { v = r.getFloatUnchecked(n); }
+	inline void readValue(const SqlStatement::ResultRow& r, int n, bool& v) { v = (r.getIntUnchecked(n) != 0); }
+	inline void readValue(const SqlStatement::ResultRow& r, int n, std::string& v) { v.assign(r.getStringUnchecked(n, "")); }
+
+	// Append szName as a quoted SQL identifier (like sqlite3_mprintf's "%w" in double quotes)
+	inline void appendIdentifier(std::string& out, const char* szName) {
+		out.push_back('"');
+		for (const char* p = szName; *p; p++) {
+			if (*p == '"')
+				out.push_back('"');
+			out.push_back(*p);
+		}
+		out.push_back('"');
+	}
+
+	template<typename T> struct ColumnLister {
+		std::string columns, placeholders;
+		template<typename M> void field(const char* szName, M T::*) {
+			if (!columns.empty()) {
+				columns.append(", ");
+				placeholders.append(", ");
+			}
+			appendIdentifier(columns, szName);
+			placeholders.append("?");
+		}
+	};
+	template<typename T> struct Binder {
+		Binder(SqlStatement& s, const T& obj) : mStatement(s), mObj(obj) {}
+		template<typename M> void field(const char*, M T::*pMember) { bindValue(mStatement, mObj.*pMember); }
+		SqlStatement& mStatement;
+		const T& mObj;
+	};
+	template<typename T> struct Reader {
+		Reader(const SqlStatement::ResultRow& row, T& obj, const int* pIndexes)
+			: mRow(row), mObj(obj), mpIndexes(pIndexes), mNext(0), mNumFields(row.numFields()) {}
+		template<typename M> void field(const char*, M T::*pMember) {
+			const int n = mpIndexes ? mpIndexes[mNext] : mNext;
+			if (n >= mNumFields)
+				throw SqlDatabaseException("Row has fewer columns than the mapped struct has fields.");
+			readValue(mRow, n, mObj.*pMember);
+			mNext++;
+		}
+		const SqlStatement::ResultRow& mRow;
+		T& mObj;
+		const int* mpIndexes;
+		int mNext;
+		const int mNumFields; // Checked once per row, so the fields can be read unchecked
+	};
+	template<typename T> struct IndexResolver {
+		IndexResolver(const SqlStatement::ResultRow& row, std::vector<int>& indexes) : mRow(row), mIndexes(indexes) {}
+		template<typename M> void field(const char* szName, M T::*) { mIndexes.push_back(mRow.fieldIndex(szName)); }
+		const SqlStatement::ResultRow& mRow;
+		std::vector<int>& mIndexes;
+	};
+}
+
+template<typename T> class SqlRowMapper {
+	typedef SqlRowTraits<T> Traits;
+public:
+	// These build their SQL on first use. Before C++11 that is not thread-safe, so call one
+	// of them once before using the mapper from several threads.
+
+	// "a", "b", "c" - the mapped columns in declaration order
+	static const std::string& columnList() { return sql().columns; }
+	// SELECT "a", "b", "c" FROM "table" - append a WHERE clause etc. as required
+	static const std::string& selectSql() { return sql().select; }
+	// INSERT INTO "table" ("a", "b", "c") VALUES (?, ?, ?)
+	static const std::string& insertSql() { return sql().insert; }
+
+	// Bind every mapped member in declaration order. Returns the statement, so one can
+	// say: SqlRowMapper<User>::bindRow(stmt, user).execute();
+	static SqlStatement& bindRow(SqlStatement& rStatement, const T& obj) {
+		SqlRowMappingDetail::Binder<T> binder(rStatement, obj);
+		Traits::visitFields(binder);
+		return rStatement;
+	}
+
+	// Decode a row whose columns are in declaration order (e.g. from selectSql()).
+	// For any other column layout, use SqlRowReader.
+	static void readRow(const SqlStatement::ResultRow& row, T& obj) {
+		SqlRowMappingDetail::Reader<T> reader(row, obj, 0);
+		Traits::visitFields(reader);
+	}
+
+	// Decode the current row and all following rows of a query built from selectSql()
+	static void readAll(SqlStatement& rStatement, std::vector<T>& results) {
+		for (; rStatement.hasRow(); rStatement.nextRow()) {
+			results.push_back(T());
+			readRow(rStatement.currentRow(), results.back());
+		}
+	}
+
+private:
+	struct Sql {
+		std::string columns, select, insert;
+		Sql() {
+			SqlRowMappingDetail::ColumnLister<T> lister;
+			Traits::visitFields(lister);
+			columns = lister.columns;
+			std::string table;
+			SqlRowMappingDetail::appendIdentifier(table, Traits::tableName());
+			select = std::string("SELECT ").append(columns).append(" FROM ").append(table);
+			insert = std::string("INSERT INTO ").append(table).append(" (").append(columns)
+				.append(") VALUES (").append(lister.placeholders).append(")");
+		}
+	};
+	static const Sql& sql() { static const Sql s; return s; }
+};
+
+// Decodes rows of an arbitrary query (any column order, extra columns allowed) into T.
+// Column names are resolved to indexes once, on the first row read; every row after
+// that is decoded by index. Use one reader per statement.
+template<typename T> class SqlRowReader {
+public:
+	void readRow(const SqlStatement::ResultRow& row, T& obj) {
+		if (mIndexes.empty()) {
+			SqlRowMappingDetail::IndexResolver<T> resolver(row, mIndexes);
+			SqlRowTraits<T>::visitFields(resolver);
+		}
+		SqlRowMappingDetail::Reader<T> reader(row, obj, mIndexes.empty() ? 0 : &mIndexes[0]);
+		SqlRowTraits<T>::visitFields(reader);
+	}
+private:
+	std::vector<int> mIndexes;
+};
+
+#endif
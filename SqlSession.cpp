@@ -0,0 +1,191 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#include "SqlSession.h"
+
+#ifdef SQLITE_ENABLE_SESSION
+
+#include "sqlite3.h"
+
+static void ThrowSessionError(const char* szWhat, int result) {
+	std::string msg(szWhat);
+	msg.append(": ").append(sqlite3_errstr(result));
+	throw SqlDatabaseException(msg);
+}
+
+void SqlChangeset::append(const SqlChangeset& rOther) {
+	if (rOther.empty())
+		return;
+	if (empty()) {
+		mBytes = rOther.mBytes;
+		return;
+	}
+	int nOut = 0;
+	void* pOut = 0;
+	const int result = sqlite3changeset_concat((int)mBytes.size(), (void*)mBytes.data(),
+		(int)rOther.mBytes.size(), (void*)rOther.mBytes.data(), &nOut, &pOut);
+	if (result != SQLITE_OK)
+		ThrowSessionError("Unable to combine changesets", result);
+	mBytes.assign((const char*)pOut, (size_t)nOut);
+	sqlite3_free(pOut);
+}
+
+SqlChangeset SqlChangeset::inverted() const {
+	if (empty())
+		return SqlChangeset();
+	int nOut = 0;
+	void* pOut = 0;
+	const int result = sqlite3changeset_invert((int)mBytes.size(), (void*)mBytes.data(), &nOut, &pOut);
+	if (result != SQLITE_OK)
+		ThrowSessionError("Unable to invert changeset", result);
+	SqlChangeset inverse(pOut, (size_t)nOut);
+	sqlite3_free(pOut);
+	return inverse;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+struct ApplyContext {
+	SqlConflictPolicy policy;
+	SqlApplyStats stats;
+};
+
+int OnConflict(void* pArg, int eConflict, sqlite3_changeset_iter*) {
+	ApplyContext& context = *static_cast<ApplyContext*>(pArg);
+	context.stats.conflicts++;
+	if (context.policy == CONFLICT_OMIT) {
+		context.stats.omitted++;
+		return SQLITE_CHANGESET_OMIT;
+	}
+	if (context.policy == CONFLICT_REPLACE) {
+		switch (eConflict) {
+			case SQLITE_CHANGESET_DATA:     // The row has different values than expected
+			case SQLITE_CHANGESET_CONFLICT: // An inserted row's primary key already exists
+				context.stats.replaced++;
+				return SQLITE_CHANGESET_REPLACE;
+			case SQLITE_CHANGESET_NOTFOUND: // The row to update or delete is not there
+				context.stats.omitted++;
+				return SQLITE_CHANGESET_OMIT;
+		}
+	}
+	return SQLITE_CHANGESET_ABORT;
+}
+}
+
+SqlApplyStats applyChangeset(SqlDatabase& rTarget, const SqlChangeset& rChangeset, SqlConflictPolicy policy) {
+	ApplyContext context;
+	context.policy = policy;
+	context.stats.conflicts = context.stats.replaced = context.stats.omitted = 0;
+	if (rChangeset.empty())
+		return context.stats;
+	sqlite3* pDB = rTarget.handle();
+	if (!pDB)
+		throw SqlDatabaseException("applyChangeset() requires an open database.");
+	const int result = sqlite3changeset_apply(pDB, (int)rChangeset.size(), (void*)rChangeset.bytes().data(),
+		0, &OnConflict, &context);
+	if (result == SQLITE_ABORT)
+		throw SqlDatabaseException("Changeset conflicts with the target database; no changes were applied.");
+	if (result != SQLITE_OK)
+		throw SqlDatabaseException(sqlite3_errmsg(pDB));
+	return context.stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+SqlSessionRecorder::SqlSessionRecorder(SqlDatabase& db, const std::vector<std::string>& szTables,
+	bool usePatchsets, const char* szDbName)
+	: mDB(db), mTables(szTables), mUsePatchsets(usePatchsets), mDbName(szDbName ? szDbName : "main"),
+	  mpSession(0), mpTransactionHandler(0), mpTransactionArg(0), mChangeHandlerId(0)
+{
+	mpSession = createSession();
+}
+
+SqlSessionRecorder::~SqlSessionRecorder() {
+	destroy();
+}
+
+void SqlSessionRecorder::destroy() {
+	if (mChangeHandlerId) {
+		mDB.removeChangeHandler(mChangeHandlerId);
+		mChangeHandlerId = 0;
+	}
+	if (mpSession) {
+		sqlite3session_delete(mpSession);
+		mpSession = 0;
+	}
+}
+
+sqlite3_session* SqlSessionRecorder::createSession() {
+	sqlite3* pDB = mDB.handle();
+	if (!pDB)
+		throw SqlDatabaseException("SqlSessionRecorder requires an open database.");
+	sqlite3_session* pSession = 0;
+	int result = sqlite3session_create(pDB, mDbName.c_str(), &pSession);
+	if (result != SQLITE_OK)
+		ThrowSessionError("Unable to create session", result);
+	if (mTables.empty()) {
+		result = sqlite3session_attach(pSession, 0);
+	} else {
+		for (size_t i = 0; i < mTables.size() && result == SQLITE_OK; i++)
+			result = sqlite3session_attach(pSession, mTables[i].c_str());
+	}
+	if (result != SQLITE_OK) {
+		sqlite3session_delete(pSession);
+		ThrowSessionError("Unable to attach session", result);
+	}
+	return pSession;
+}
+
+bool SqlSessionRecorder::isEmpty() const {
+	return !mpSession || sqlite3session_isempty(mpSession);
+}
+
+SqlChangeset SqlSessionRecorder::takeChangeset() {
+	if (!mpSession)
+		throw SqlDatabaseException("takeChangeset() called after destroy().");
+	if (sqlite3session_isempty(mpSession))
+		return SqlChangeset();
+	// A session accumulates changes for as long as it exists, so start a new one for the
+	// next window. Create it first, so that if that fails the changes are still recorded.
+	sqlite3_session* pNext = createSession();
+	int nLen = 0;
+	void* pData = 0;
+	const int result = mUsePatchsets ? sqlite3session_patchset(mpSession, &nLen, &pData)
+		: sqlite3session_changeset(mpSession, &nLen, &pData);
+	if (result != SQLITE_OK) {
+		sqlite3session_delete(pNext);
+		ThrowSessionError("Unable to get changeset", result);
+	}
+	SqlChangeset changes(pData, (size_t)nLen);
+	sqlite3_free(pData);
+	sqlite3session_delete(mpSession);
+	mpSession = pNext;
+	return changes;
+}
+
+void SqlSessionRecorder::setTransactionHandler(void(*pHandler)(void*, const SqlChangeset&), void* customArg) {
+	mpTransactionHandler = pHandler;
+	mpTransactionArg = customArg;
+	if (pHandler && !mChangeHandlerId)
+		mChangeHandlerId = mDB.onChange(0, &SqlSessionRecorder::onTableChanged, this);
+	else if (!pHandler && mChangeHandlerId) {
+		mDB.removeChangeHandler(mChangeHandlerId);
+		mChangeHandlerId = 0;
+	}
+}
+
+void SqlSessionRecorder::onTableChanged(void* pArg, const char*) {
+	// Called after a transaction commits, once for each table it changed: the first call
+	// takes all of the transaction's changes, and the session is then empty for the rest
+	SqlSessionRecorder* self = static_cast<SqlSessionRecorder*>(pArg);
+	if (!self->mpTransactionHandler || self->isEmpty())
+		return;
+	SqlChangeset changes = self->takeChangeset();
+	if (!changes.empty())
+		self->mpTransactionHandler(self->mpTransactionArg, changes);
+}
+
+#endif // SQLITE_ENABLE_SESSION
@@ -0,0 +1,114 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// SqlSession - records the changes made through a connection as changesets,
+// using the SQLite session extension, and applies them to another database,
+// so that a replica can be kept up to date incrementally.
+//
+// Requires SQLite to be compiled with SQLITE_ENABLE_SESSION and
+// SQLITE_ENABLE_PREUPDATE_HOOK (and this file to be compiled with the same
+// defines). Tables must have a PRIMARY KEY to be recorded.
+// See http://www.sqlite.org/sessionintro.html
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef CPP_SQL_SESSION_H
+#define CPP_SQL_SESSION_H
+
+#include "CppSqlWrapper.h"
+
+#ifdef SQLITE_ENABLE_SESSION
+
+#include <string>
+#include <vector>
+
+struct sqlite3_session;
+
+// A set of changes to a database, in SQLite's compact binary changeset (or patchset)
+// format, which can be stored or sent as is and later applied with applyChangeset().
+class SqlChangeset {
+public:
+	SqlChangeset() {}
+	explicit SqlChangeset(const std::string& bytes) : mBytes(bytes) {}
+	SqlChangeset(const void* pData, size_t nLen) : mBytes((const char*)pData, nLen) {}
+
+	bool empty() const { return mBytes.empty(); }
+	size_t size() const { return mBytes.size(); }
+	// The serialized changeset
+	const std::string& bytes() const { return mBytes; }
+
+	// Add the changes in rOther (which must be of the same kind, changeset or patchset)
+	// after the changes in this one
+	void append(const SqlChangeset& rOther);
+	// A changeset that undoes this one (not possible for patchsets)
+	SqlChangeset inverted() const;
+
+	void swap(SqlChangeset& rOther) { mBytes.swap(rOther.mBytes); }
+private:
+	std::string mBytes;
+};
+
+// What to do when applying a change that does not match the target database
+enum SqlConflictPolicy {
+	CONFLICT_ABORT,   // Roll back the whole changeset and throw
+	CONFLICT_REPLACE, // The incoming change wins; a change to a missing row is skipped
+	CONFLICT_OMIT,    // Skip the conflicting change and keep the target's data
+};
+
+struct SqlApplyStats {
+	int conflicts;   // Changes that did not match the target database
+	int replaced;    // ...of which were applied anyway
+	int omitted;     // ...of which were skipped
+};
+
+// Apply rChangeset to rTarget in a single transaction (of its own, or as a savepoint in
+// the current one). Conflicts are resolved by policy; a change that would break a
+// constraint (e.g. UNIQUE or FOREIGN KEY) is always treated as CONFLICT_ABORT, except
+// under CONFLICT_OMIT. Throws SqlDatabaseException if the changeset was rolled back.
+SqlApplyStats applyChangeset(SqlDatabase& rTarget, const SqlChangeset& rChangeset,
+	SqlConflictPolicy policy = CONFLICT_ABORT);
+
+// Records the changes made through one connection. Take what has been recorded with
+// takeChangeset() at whatever interval suits (e.g. on a timer), or set a handler to
+// receive one changeset per committed transaction.
+class SqlSessionRecorder {
+public:
+	// Record changes to the tables in szTables (all tables if empty) of the given attached
+	// database. Patchsets are smaller than changesets (an UPDATE or DELETE carries only the
+	// primary key and new values), but cannot be inverted and detect fewer conflicts.
+	SqlSessionRecorder(SqlDatabase& db, const std::vector<std::string>& szTables = std::vector<std::string>(),
+		bool usePatchsets = false, const char* szDbName = "main");
+	~SqlSessionRecorder();
+
+	// True if no changes have been recorded since the last takeChangeset()
+	bool isEmpty() const;
+	// Get the changes recorded so far, and start recording afresh. Only committed changes
+	// are included; call this outside of transactions.
+	SqlChangeset takeChangeset();
+
+	// Call pHandler with the changes of each transaction as soon as it commits (pass NULL
+	// to stop). This uses SqlDatabase::onChange(), so transactions run with sqlExecute()
+	// and SqlStatement are both seen.
+	void setTransactionHandler(void(*pHandler)(void*, const SqlChangeset&), void* customArg = 0);
+
+	void destroy();
+private:
+	SqlSessionRecorder(const SqlSessionRecorder&);
+	SqlSessionRecorder& operator=(const SqlSessionRecorder&);
+
+	sqlite3_session* createSession();
+	static void onTableChanged(void* pArg, const char* szTable);
+
+	SqlDatabase& mDB;
+	const std::vector<std::string> mTables;
+	const bool mUsePatchsets;
+	const std::string mDbName;
+	sqlite3_session* mpSession;
+
+	void(*mpTransactionHandler)(void*, const SqlChangeset&);
+	void* mpTransactionArg;
+	int mChangeHandlerId;
+};
+
+#endif // SQLITE_ENABLE_SESSION
+#endif
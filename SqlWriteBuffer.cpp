@@ -0,0 +1,218 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#include "SqlWriteBuffer.h"
+
+#include <chrono>
+#include <sstream>
+
+#include "sqlite3.h"
+
+static std::atomic<uint64_t> gNextWriteBufferId(1);
+
+SqlWriteBuffer::SqlWriteBuffer(SqlDatabase& db, const char* szInsertSQL, const SqlWriteBufferPolicy& policy)
+	: mDB(db), mInsert(db.sqlCompile(szInsertSQL, PREPARE_PERSISTENT)), mNumColumns(mInsert.numParams()),
+	  mPolicy(policy), mId(gNextWriteBufferId++), mPendingRows(0), mPendingBytes(0), mLimitSignalled(false),
+	  mStopping(false), mFlushRequested(0), mFlushDone(0), mpErrorHandler(0), mpErrorArg(0)
+{
+	if (mPolicy.synchronous != SYNCHRONOUS_UNCHANGED) {
+		std::ostringstream sql;
+		sql << "PRAGMA synchronous = " << (int)mPolicy.synchronous;
+		mDB.sqlExecute(sql.str().c_str());
+	}
+	mThread = std::thread(&SqlWriteBuffer::run, this);
+}
+
+SqlWriteBuffer::~SqlWriteBuffer() {
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mWake.notify_one();
+	mThread.join(); // The background thread writes the remaining rows before it exits
+}
+
+SqlWriteBuffer::ThreadBuffer& SqlWriteBuffer::threadBuffer() {
+	// Each thread remembers the buffer it last used, so the registry is only locked when a
+	// thread adds to a different SqlWriteBuffer from last time
+	struct Cache {
+		uint64_t id;
+		ThreadBuffer* pBuffer;
+	};
+	static thread_local Cache cache = {0, 0};
+	if (cache.id == mId)
+		return *cache.pBuffer;
+	const std::thread::id thisThread = std::this_thread::get_id();
+	std::lock_guard<std::mutex> lock(mBuffersMutex);
+	cache.id = mId;
+	cache.pBuffer = 0;
+	for (size_t i = 0; i < mBuffers.size() && !cache.pBuffer; i++) {
+		if (mBuffers[i]->owner == thisThread)
+			cache.pBuffer = mBuffers[i].get();
+	}
+	if (!cache.pBuffer) {
+		mBuffers.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+		mBuffers.back()->owner = thisThread;
+		cache.pBuffer = mBuffers.back().get();
+	}
+	return *cache.pBuffer;
+}
+
+template<typename Iterator>
+void SqlWriteBuffer::addRow(Iterator begin, Iterator end) {
+	if (end - begin != mNumColumns) {
+		std::ostringstream msg;
+		msg << "SqlWriteBuffer::add() was given " << (end - begin) << " values for " << mNumColumns << " columns.";
+		throw SqlDatabaseException(msg.str());
+	}
+	size_t bytes = 0;
+	for (Iterator it = begin; it != end; ++it)
+		bytes += sizeof(SqlValue) + it->asString().size();
+	ThreadBuffer& buffer = threadBuffer();
+	{
+		std::lock_guard<std::mutex> lock(buffer.mutex);
+		buffer.values.insert(buffer.values.end(), begin, end);
+		buffer.bytes += bytes;
+	}
+	mPendingBytes += (int64_t)bytes;
+	const int64_t rows = ++mPendingRows;
+	// The counts can step past a limit without equalling it while the background thread is
+	// subtracting the rows it has taken, so test for reaching it, and only signal once
+	if (rows == 1 || (limitReached() && !mLimitSignalled.exchange(true))) {
+		// Start the delay timer, or write now. Rare enough to take the lock, which makes
+		// sure the background thread cannot miss the notification.
+		{ std::lock_guard<std::mutex> lock(mMutex); }
+		mWake.notify_one();
+	}
+}
+
+void SqlWriteBuffer::add(const std::vector<SqlValue>& row) {
+	addRow(row.begin(), row.end());
+}
+
+void SqlWriteBuffer::add(std::initializer_list<SqlValue> row) {
+	addRow(row.begin(), row.end());
+}
+
+void SqlWriteBuffer::flush() {
+	std::unique_lock<std::mutex> lock(mMutex);
+	const uint64_t generation = ++mFlushRequested;
+	mWake.notify_one();
+	mFlushed.wait(lock, [this, generation]() { return mFlushDone >= generation; });
+}
+
+void SqlWriteBuffer::setErrorHandler(void(*pHandler)(void*, const char*, size_t), void* customArg) {
+	std::lock_guard<std::mutex> lock(mStatsMutex);
+	mpErrorHandler = pHandler;
+	mpErrorArg = customArg;
+}
+
+SqlWriteBufferStats SqlWriteBuffer::stats() const {
+	std::lock_guard<std::mutex> lock(mStatsMutex);
+	return mStats;
+}
+
+bool SqlWriteBuffer::limitReached() const {
+	return (mPolicy.maxRows > 0 && mPendingRows >= mPolicy.maxRows) ||
+		(mPolicy.maxBytes > 0 && mPendingBytes >= (int64_t)mPolicy.maxBytes);
+}
+
+void SqlWriteBuffer::run() {
+	std::unique_lock<std::mutex> lock(mMutex);
+	for (;;) {
+		// Sleep until the first row arrives...
+		mWake.wait(lock, [this]() { return mStopping || mFlushRequested != mFlushDone || mPendingRows > 0; });
+		// ...then until a limit is reached or maxDelayMs has passed
+		if (mPolicy.maxDelayMs > 0)
+			mWake.wait_for(lock, std::chrono::milliseconds(mPolicy.maxDelayMs),
+				[this]() { return mStopping || mFlushRequested != mFlushDone || limitReached(); });
+		else
+			mWake.wait(lock, [this]() { return mStopping || mFlushRequested != mFlushDone || limitReached(); });
+
+		const bool stopping = mStopping;
+		const uint64_t flushRequested = mFlushRequested;
+		lock.unlock();
+		writeBufferedRows();
+		lock.lock();
+		if (mFlushDone != flushRequested) {
+			mFlushDone = flushRequested;
+			mFlushed.notify_all();
+		}
+		if (stopping)
+			break;
+	}
+}
+
+void SqlWriteBuffer::writeBufferedRows() {
+	// Take every thread's rows. A row added after its buffer has been emptied here is left
+	// for the next write.
+	mWriting.clear();
+	size_t bytes = 0;
+	{
+		std::lock_guard<std::mutex> lock(mBuffersMutex);
+		for (size_t i = 0; i < mBuffers.size(); i++) {
+			ThreadBuffer& buffer = *mBuffers[i];
+			std::lock_guard<std::mutex> bufferLock(buffer.mutex);
+			mWriting.insert(mWriting.end(), buffer.values.begin(), buffer.values.end());
+			bytes += buffer.bytes;
+			buffer.values.clear();
+			buffer.bytes = 0;
+		}
+	}
+	const size_t rows = mNumColumns > 0 ? mWriting.size() / mNumColumns : 0;
+	mPendingRows -= (int64_t)rows;
+	mPendingBytes -= (int64_t)bytes;
+	mLimitSignalled = false;
+	if (rows == 0)
+		return;
+
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::string error;
+	try {
+		mDB.sqlExecute("BEGIN IMMEDIATE");
+		try {
+			for (size_t i = 0; i < mWriting.size(); i += mNumColumns) {
+				for (int column = 0; column < mNumColumns; column++)
+					mInsert.bind(mWriting[i + column]);
+				mInsert.run();
+			}
+			mDB.sqlExecute("COMMIT");
+		} catch (...) {
+			// SQLite may already have rolled back (e.g. on SQLITE_FULL); keep the original error
+			if (!sqlite3_get_autocommit(mDB.handle())) {
+				try {
+					mDB.sqlExecute("ROLLBACK");
+				} catch (const SqlDatabaseException&) {}
+			}
+			throw;
+		}
+	} catch (const std::exception& e) {
+		error = e.what();
+	}
+	const uint64_t durationUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start).count();
+
+	void(*pHandler)(void*, const char*, size_t) = 0;
+	void* pHandlerArg = 0;
+	{
+		std::lock_guard<std::mutex> lock(mStatsMutex);
+		mStats.flushes++;
+		if (error.empty())
+			mStats.rowsWritten += rows;
+		else
+			mStats.rowsFailed += rows;
+		if (rows > mStats.maxRowsPerFlush)
+			mStats.maxRowsPerFlush = rows;
+		mStats.lastFlushUs = durationUs;
+		if (durationUs > mStats.maxFlushUs)
+			mStats.maxFlushUs = durationUs;
+		if (!error.empty()) {
+			pHandler = mpErrorHandler;
+			pHandlerArg = mpErrorArg;
+		}
+	}
+	if (pHandler)
+		pHandler(pHandlerArg, error.c_str(), rows);
+}
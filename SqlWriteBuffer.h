@@ -0,0 +1,112 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// SqlWriteBuffer - collects rows from many threads and inserts them in large
+// transactions on a background thread, instead of committing each row.
+// Requires C++11.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef CPP_SQL_WRITE_BUFFER_H
+#define CPP_SQL_WRITE_BUFFER_H
+
+#include "CppSqlWrapper.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Values for SqlWriteBufferPolicy::synchronous; see http://www.sqlite.org/pragma.html#pragma_synchronous
+enum SqlSynchronousMode {
+	SYNCHRONOUS_UNCHANGED=-1, // Leave the connection's setting alone
+	SYNCHRONOUS_OFF=0,        // Fastest, but a power failure can lose or corrupt recent transactions
+	SYNCHRONOUS_NORMAL=1,     // In WAL mode, a power failure can lose recent transactions, but not corrupt
+	SYNCHRONOUS_FULL=2,       // Every commit is durable
+};
+
+struct SqlWriteBufferPolicy {
+	// Write the buffered rows once any of these is reached (0 = no limit of that kind)
+	int maxRows = 10000;
+	size_t maxBytes = 4 * 1024 * 1024;
+	int maxDelayMs = 100;
+	SqlSynchronousMode synchronous = SYNCHRONOUS_UNCHANGED;
+};
+
+struct SqlWriteBufferStats {
+	uint64_t rowsWritten = 0;
+	uint64_t rowsFailed = 0;     // Rows in transactions that failed and were rolled back
+	uint64_t flushes = 0;        // Transactions committed or attempted
+	uint64_t maxRowsPerFlush = 0;
+	uint64_t lastFlushUs = 0;
+	uint64_t maxFlushUs = 0;
+};
+
+class SqlWriteBuffer {
+public:
+	// szInsertSQL is a statement with one parameter per column, e.g.
+	// "INSERT INTO events(time, kind, data) VALUES(?,?,?)". The buffer uses db from its own
+	// thread, so give it a connection of its own.
+	SqlWriteBuffer(SqlDatabase& db, const char* szInsertSQL, const SqlWriteBufferPolicy& policy = SqlWriteBufferPolicy());
+	~SqlWriteBuffer(); // Writes any rows still buffered
+
+	// Add a row, with one value per parameter of the insert statement. May be called from
+	// any number of threads: each thread has a buffer of its own, so they do not contend.
+	void add(const std::vector<SqlValue>& row);
+	void add(std::initializer_list<SqlValue> row);
+	// Write everything added so far, and wait until it has been committed
+	void flush();
+
+	// Called (on the background thread) when a transaction fails; its rows are discarded
+	void setErrorHandler(void(*pHandler)(void*, const char* szMessage, size_t nRowsLost), void* customArg = 0);
+	SqlWriteBufferStats stats() const;
+
+private:
+	SqlWriteBuffer(const SqlWriteBuffer&);
+	SqlWriteBuffer& operator=(const SqlWriteBuffer&);
+
+	struct ThreadBuffer {
+		std::mutex mutex; // Only contended while the background thread is taking the rows
+		std::vector<SqlValue> values; // The rows, one after another
+		size_t bytes = 0;
+		std::thread::id owner; // The thread that adds to this buffer
+	};
+	ThreadBuffer& threadBuffer();
+	template<typename Iterator> void addRow(Iterator begin, Iterator end);
+	bool limitReached() const;
+	void run();
+	void writeBufferedRows();
+
+	SqlDatabase& mDB;
+	SqlStatement mInsert;
+	const int mNumColumns;
+	const SqlWriteBufferPolicy mPolicy;
+	const uint64_t mId; // Identifies this buffer in each thread's cache of its ThreadBuffer
+
+	std::mutex mBuffersMutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> mBuffers; // One per thread that has called add()
+
+	std::atomic<int64_t> mPendingRows;
+	std::atomic<int64_t> mPendingBytes;
+	std::atomic<bool> mLimitSignalled; // Set when add() wakes the background thread for a limit
+
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::condition_variable mFlushed;
+	bool mStopping;
+	uint64_t mFlushRequested; // Generation of the latest flush() request
+	uint64_t mFlushDone;      // ...and of the latest one completed
+
+	std::vector<SqlValue> mWriting; // Rows being written; only used by the background thread
+
+	mutable std::mutex mStatsMutex;
+	SqlWriteBufferStats mStats;
+	void(*mpErrorHandler)(void*, const char*, size_t);
+	void* mpErrorArg;
+
+	std::thread mThread;
+};
+
+#endif
@@ -0,0 +1,132 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// Micro-benchmarks for the fast paths of SqlStatement, on an in-memory database:
+//     SqlBenchmark [rows]
+// - reading integer columns with getIntField() and with getIntUnchecked()
+// - single-row inserts with bind().execute() and with bind().run()
+// - binding by position, through ParamRef handles and with bindNamed()
+// Each figure is the best of three runs. Build with optimization, e.g.
+//     g++ -O2 tools/SqlBenchmark.cpp CppSqlWrapper.cpp -lsqlite3
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#include "../CppSqlWrapper.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+static double Seconds(clock_t start) {
+	return double(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void Report(const char* szName, double seconds, double nOperations, const char* szUnit) {
+	printf("  %-28s %8.1f ns per %s\n", szName, seconds * 1e9 / nOperations, szUnit);
+}
+
+// Reads every value of an 8-column integer table, with the checked or the unchecked
+// accessor. Returns the time taken, less the time spent stepping.
+static double ReadColumns(SqlStatement& query, bool unchecked, double stepSeconds, int64_t& rSum) {
+	clock_t start = clock();
+	for (query.execute(); query.hasRow(); query.nextRow()) {
+		const SqlStatement::ResultRow& row = query.currentRow();
+		if (unchecked) {
+			for (int i = 0; i < 8; i++)
+				rSum += row.getIntUnchecked(i);
+		} else {
+			for (int i = 0; i < 8; i++)
+				rSum += row.getIntField(i);
+		}
+	}
+	return Seconds(start) - stepSeconds;
+}
+
+static void BenchmarkAccessors(SqlDatabase& db, int nRows) {
+	db.sqlExecute("CREATE TABLE wide(a, b, c, d, e, f, g, h)");
+	SqlStatement insert = db.sqlCompile("INSERT INTO wide VALUES (?1, ?1 + 1, ?1 + 2, ?1 + 3, ?1 + 4, ?1 + 5, ?1 + 6, ?1 + 7)");
+	db.sqlExecute("BEGIN");
+	for (int i = 0; i < nRows; i++)
+		insert.bind(i).run();
+	db.sqlExecute("COMMIT");
+
+	SqlStatement query = db.sqlCompile("SELECT * FROM wide");
+	clock_t start = clock();
+	for (query.execute(); query.hasRow(); query.nextRow()) {}
+	const double stepSeconds = Seconds(start);
+
+	int64_t sum = 0;
+	double checked = 1e9, unchecked = 1e9;
+	for (int run = 0; run < 3; run++) {
+		const double c = ReadColumns(query, false, stepSeconds, sum);
+		const double u = ReadColumns(query, true, stepSeconds, sum);
+		if (c < checked)
+			checked = c;
+		if (u < unchecked)
+			unchecked = u;
+	}
+	printf("Reading %d rows x 8 integer columns (excluding stepping):\n", nRows);
+	Report("getIntField()", checked, 8.0 * nRows, "value");
+	Report("getIntUnchecked()", unchecked, 8.0 * nRows, "value");
+	if (sum == 42)
+		printf("\n"); // Keeps the reads from being optimized away
+}
+
+enum InsertMethod { INSERT_EXECUTE, INSERT_RUN, INSERT_PARAMREF, INSERT_NAMED };
+
+static double Insert(SqlDatabase& db, int nRows, InsertMethod method) {
+	db.sqlExecute("DELETE FROM narrow");
+	SqlStatement insert = db.sqlCompile("INSERT INTO narrow VALUES (:id, :name, :score)");
+	const SqlStatement::ParamRef id = insert.param(":id");
+	const SqlStatement::ParamRef name = insert.param(":name");
+	const SqlStatement::ParamRef score = insert.param(":score");
+	db.sqlExecute("BEGIN");
+	clock_t start = clock();
+	for (int i = 0; i < nRows; i++) {
+		switch (method) {
+			case INSERT_EXECUTE: insert.bind(i).bind("name").bind(i * 0.5).execute(); break;
+			case INSERT_RUN: insert.bind(i).bind("name").bind(i * 0.5).run(); break;
+			case INSERT_PARAMREF: insert.bind(id, i).bind(name, "name").bind(score, i * 0.5).run(); break;
+			case INSERT_NAMED: insert.bindNamed(":id", i).bindNamed(":name", "name").bindNamed(":score", i * 0.5).run(); break;
+		}
+	}
+	const double seconds = Seconds(start);
+	db.sqlExecute("COMMIT");
+	return seconds;
+}
+
+static double BestInsert(SqlDatabase& db, int nRows, InsertMethod method) {
+	double best = 1e9;
+	for (int run = 0; run < 3; run++) {
+		const double seconds = Insert(db, nRows, method);
+		if (seconds < best)
+			best = seconds;
+	}
+	return best;
+}
+
+static void BenchmarkInserts(SqlDatabase& db, int nRows) {
+	db.sqlExecute("CREATE TABLE narrow(id INTEGER, name TEXT, score REAL)");
+	printf("Inserting %d rows of 3 parameters in one transaction:\n", nRows);
+	Report("bind().execute()", BestInsert(db, nRows, INSERT_EXECUTE), nRows, "row");
+	Report("bind().run()", BestInsert(db, nRows, INSERT_RUN), nRows, "row");
+	Report("bind(ParamRef).run()", BestInsert(db, nRows, INSERT_PARAMREF), nRows, "row");
+	Report("bindNamed().run()", BestInsert(db, nRows, INSERT_NAMED), nRows, "row");
+}
+
+int main(int argc, char** argv) {
+	const int nRows = argc > 1 ? atoi(argv[1]) : 1000000;
+	if (nRows <= 0) {
+		fprintf(stderr, "Usage: %s [rows]\n", argv[0]);
+		return 2;
+	}
+	try {
+		SqlDatabase db(":memory:", false);
+		BenchmarkAccessors(db, nRows);
+		BenchmarkInserts(db, nRows);
+	} catch (const std::exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
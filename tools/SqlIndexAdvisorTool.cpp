@@ -0,0 +1,48 @@
+////////////////////////////////////////////////////////////////////////////////
+// CppSqlWrapper - A lightweight C++ wrapper for SQLite3.
+//
+// Command-line front end for SqlIndexAdvisor:
+//     SqlIndexAdvisorTool <database file> <workload file> [max ms per statement]
+// The workload file is written by SqlWorkload::save(). The database is only read.
+//
+// See CppSqlWrapper.h for copyright and license information.
+////////////////////////////////////////////////////////////////////////////////
+#include "../SqlIndexAdvisor.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <database file> <workload file> [max ms per statement]\n", argv[0]);
+		return 2;
+	}
+	std::ifstream in(argv[2], std::ios::binary);
+	SqlWorkload workload;
+	if (!in || !workload.load(in)) {
+		fprintf(stderr, "Unable to read workload file %s\n", argv[2]);
+		return 1;
+	}
+	try {
+		SqlIndexAdvisor advisor(argv[1]);
+		const std::vector<SqlIndexRecommendation> recs = advisor.analyze(workload, argc > 3 ? atoi(argv[3]) : 10000);
+		printf("%d distinct statements, %lld executions, %d skipped\n", (int)workload.statements().size(),
+			(long long)workload.totalExecutions(), advisor.numSkipped());
+		if (recs.empty())
+			printf("No indexes to recommend.\n");
+		for (size_t i = 0; i < recs.size(); i++) {
+			const SqlIndexRecommendation& r = recs[i];
+			printf("\n%s;\n", r.createSQL.c_str());
+			printf("  helps %d statements (%lld executions): %.1f%% fewer VM steps, full scan steps %lld -> %lld\n",
+				r.statements, (long long)r.executions, 100.0 * r.benefit(),
+				(long long)r.fullScanStepsBefore, (long long)r.fullScanStepsAfter);
+			if (r.slowedStatements > 0)
+				printf("  (net of slowing down %d statements, %lld executions)\n", r.slowedStatements, (long long)r.slowedExecutions);
+		}
+	} catch (const std::exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}